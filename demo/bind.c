@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sjson.h>
+
+#define println(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+typedef struct address {
+  char* city;
+  int zip;
+} address_t;
+
+typedef struct player {
+  int64_t id;
+  char* name;
+  double rating;
+  int retired;
+  char** matches;
+  int nmatches;
+  address_t home;
+} player_t;
+
+static const jfield_t address_fields[] = {
+    jfield_string("city", address_t, city),
+    jfield_int("zip", address_t, zip),
+};
+static jschema_t address_schema = jschema_of(address_t, address_fields);
+
+static const jfield_t player_fields[] = {
+    jfield_int64("id", player_t, id),
+    jfield_string("name", player_t, name),
+    jfield_double("rating", player_t, rating),
+    jfield_bool("retired", player_t, retired),
+    jfield_array("matches", player_t, matches, nmatches, JBIND_STRING, char*,
+                 0),
+    jfield_object("home", player_t, home, &address_schema),
+};
+static jschema_t player_schema = jschema_of(player_t, player_fields);
+
+void test_decode() {
+  const char* json =
+      "{\"name\": \"Zywoo\", \"id\": 9007199254740993, \"rating\": 1.43, "
+      "\"team\": {\"name\": \"Vitality\"}, \"matches\": [\"EPL\", \"Major\"], "
+      "\"retired\": false, \"home\": {\"city\": \"Paris\", \"zip\": 75000}}";
+  player_t player;
+
+  println("==== STRUCT BINDING ====");
+  if (!jbind_decode(&player_schema, &player, json, strlen(json), 0, 0)) {
+    println("error: %s", jerror());
+    return;
+  }
+  println("id: %lld", (long long)player.id);
+  println("name: %s, rating: %g", player.name, player.rating);
+  for (int i = 0; i < player.nmatches; i++)
+    println("match #%d: %s", i, player.matches[i]);
+  println("home: %s %d", player.home.city, player.home.zip);
+
+  char* jstr = jbind_to_string(&player_schema, &player, 0);
+  println("%s", jstr);
+  free(jstr);
+  jbind_free(&player_schema, &player);
+}
+
+void test_mismatch() {
+  const char* json = "{\"name\": \"Zywoo\", \"rating\": \"high\"}";
+  player_t player;
+
+  println("==== STRUCT BINDING MISMATCH ====");
+  if (!jbind_decode(&player_schema, &player, json, strlen(json), 0, 0))
+    println("error: %s", jerror());
+}
+
+int main() {
+  if (!jschema_prepare(&player_schema)) {
+    println("error: %s", jerror());
+    return EXIT_FAILURE;
+  }
+  test_decode();
+  test_mismatch();
+  jschema_release(&player_schema);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sjson.h>
+
+#define println(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+#define THREADS 16
+#define ROUTES 4096
+#define ROUNDS 64
+
+/* A tree with no writers can be shared by readers without any lock. */
+jnode_t* routes;
+
+void* reader(void* arg) {
+  (void)arg;
+  long misses = 0;
+  char key[32];
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < ROUTES; i++) {
+      sprintf(key, "/api/v1/route/%d", i);
+      jnode_t* route = jobject_get(routes, key);
+      if (!route || !jobject_has(routes, key)) {
+        misses++;
+        continue;
+      }
+      jnode_t* port = jobject_get(route, "port");
+      if (!port || jas_number(port)->value != i % 1000) misses++;
+    }
+  }
+  return (void*)misses;
+}
+
+int main() {
+  routes = jobject_new();
+  char key[32];
+  for (int i = 0; i < ROUTES; i++) {
+    jnode_t* route = jobject_new();
+    jobject_put(route, "port", jnumber_new(i % 1000));
+    jobject_put(route, "host", jstring_new(0, "10.0.0.1"));
+    sprintf(key, "/api/v1/route/%d", i);
+    jobject_put(routes, key, route);
+  }
+  jobject_compact(routes);
+
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], 0, reader, 0);
+
+  long misses = 0;
+  for (int i = 0; i < THREADS; i++) {
+    void* ret;
+    pthread_join(threads[i], &ret);
+    misses += (long)ret;
+  }
+
+  println("==== CONCURRENT READ ====");
+  println("%d threads x %d lookups, misses: %ld", THREADS, ROUTES * ROUNDS,
+          misses);
+
+  jdelete(routes);
+  return misses ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sjson.h>
+
+#define println(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+#define RECORDS 200000
+
+typedef struct counter {
+  long docs;
+  long next_id;  // checks ordering
+  long misordered;
+} counter_t;
+
+int count_doc(jnode_t* doc, void* ctx) {
+  counter_t* counter = ctx;
+  jnode_t* id = jobject_get(doc, "id");
+  if (!id || jas_number(id)->value != counter->next_id) counter->misordered++;
+  counter->next_id++;
+  counter->docs++;
+  jdelete(doc);
+  return 1;
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+  char path[] = "/tmp/sjson-ndjson-XXXXXX";
+  int fd = mkstemp(path);
+  FILE* fp = fd < 0 ? 0 : fdopen(fd, "w");
+  if (!fp) {
+    println("Failed to create temporary file");
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < RECORDS; i++) {
+    fprintf(fp,
+            "{\"id\": %d, \"user\": {\"name\": \"user%d\", \"tags\": [\"a\", "
+            "\"b\", \"c\"]}, \"event\": \"click\", \"ts\": %d.5}\n",
+            i, i % 997, 1700000000 + i);
+  }
+  long size = ftell(fp);
+  fclose(fp);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) cpus = 1;
+
+  println("==== NDJSON BENCHMARK ====");
+  println("%d records, %.1f MB, %ld cpus", RECORDS, size / 1e6, cpus);
+  println("%8s %10s %10s %10s %8s", "threads", "docs", "ms", "MB/s",
+          "speedup");
+
+  int status = EXIT_SUCCESS;
+  double base = 0;
+  for (long threads = 1;; threads = threads * 2 > cpus ? cpus : threads * 2) {
+    jndjson_opts_t opts = {.threads = threads, .ordered = 1};
+    counter_t counter = {};
+    double start = now();
+    int ok = jndjson_read(path, &opts, count_doc, &counter);
+    double elapsed = now() - start;
+    if (!ok || counter.docs != RECORDS || counter.misordered) {
+      println("Failed: %s", jerror() ? jerror() : "wrong documents");
+      status = EXIT_FAILURE;
+      break;
+    }
+    if (threads == 1) base = elapsed;
+    println("%8ld %10ld %10.1f %10.1f %7.2fx", threads, counter.docs,
+            elapsed * 1e3, size / 1e6 / elapsed, base / elapsed);
+    if (threads == cpus) break;
+  }
+
+  remove(path);
+  return status;
+}
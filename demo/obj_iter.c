@@ -4,13 +4,19 @@
 
 #define println(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
 
-void print_kv(const char* key, jnode_t* value) {
-  static int count = 0;
+void print_kv(const char* key, jnode_t* value, void* ctx) {
+  int* count = ctx;
   char* jstr = jto_string(value);
-  println("#%4d [%s] = %s", ++count, key, jstr);
+  println("#%4d [%s] = %s", ++*count, key, jstr);
   free(jstr);
 }
 
+int print_name(jnode_t* name, void* ctx) {
+  int* count = ctx;
+  println("#%4d %s", ++*count, jstring_content(name));
+  return 1;
+}
+
 int main() {
   const char* json_path = "demo/obj_iter.json";
 
@@ -34,17 +40,19 @@ int main() {
   }
 
   {
-    jnode_t* web_app = jobject_get(json, "web-app");
-    {
-      jnode_t* servlet = jobject_get(web_app, "servlet");
-      {
-        jnode_t* item = jarray_get(servlet, 0);
-        {
-          jnode_t* init_param = jobject_get(item, "init-param");
-          jobject_foreach(init_param, print_kv);
-        }
-      }
-    }
+    jpath_t* path = jpointer_compile("/web-app/servlet/0/init-param");
+    jnode_t* init_param = jpath_get(path, json);
+    int count = 0;
+    jobject_foreach_ctx(init_param, print_kv, &count);
+    jpath_free(path);
+  }
+
+  {
+    jpath_t* path = jpath_compile("$.web-app.servlet[*].servlet-name");
+    int count = 0;
+    println("servlets:");
+    jpath_foreach(path, json, print_name, &count);
+    jpath_free(path);
   }
 
   jdelete(json);
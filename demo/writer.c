@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sjson.h>
+
+#define println(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+
+void test_response() {
+  /*
+  {
+    "name": "Zywoo",
+    "age": 25,
+    "rating": 1.43,
+    "matches": ["EPL", "Major", "IEM"],
+    "retired": false
+  }
+  */
+  const char* matches[] = {"EPL", "Major", "IEM"};
+  jsink_t sink;
+  jwriter_t writer;
+  jsink_init_file(&sink, stdout, NULL, 0);
+  jwriter_init(&writer, &sink);
+
+  println("==== JSON WRITER ====");
+  jwriter_begin_object(&writer);
+  {
+    jwriter_key(&writer, "name", 0);
+    jwriter_value_string(&writer, "Zywoo", 0);
+    jwriter_key(&writer, "age", 0);
+    jwriter_value_number(&writer, 25);
+    jwriter_key(&writer, "rating", 0);
+    jwriter_value_number(&writer, 1.43);
+    jwriter_key(&writer, "matches", 0);
+    jwriter_begin_array(&writer);
+    for (int i = 0; i < 3; i++) jwriter_value_string(&writer, matches[i], 0);
+    jwriter_end_array(&writer);
+    jwriter_key(&writer, "retired", 0);
+    jwriter_value_bool(&writer, 0);
+  }
+  jwriter_end_object(&writer);
+  if (!jwriter_finish(&writer)) println("\nerror: %s", jerror());
+  println("");
+}
+
+void test_misuse() {
+  char buffer[64];
+  jsink_t sink;
+  jwriter_t writer;
+  jsink_init_file(&sink, stdout, buffer, sizeof(buffer));
+  jwriter_init(&writer, &sink);
+
+  println("==== JSON WRITER MISUSE ====");
+  jwriter_begin_object(&writer);
+  if (!jwriter_value_number(&writer, 1)) println("error: %s", jerror());
+  if (!jwriter_finish(&writer)) println("error: %s", jerror());
+}
+
+int main() {
+  test_response();
+  test_misuse();
+  return 0;
+}
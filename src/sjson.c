@@ -1,7 +1,33 @@
+#ifndef SJSON_NO_PARALLEL
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef SJSON_NO_PARALLEL
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <sjson.h>
 
@@ -9,22 +35,42 @@
  *       ERROR OPERATION
  * ========================== */
 
-#define MSG_BUFFER_LEN 1024
-#define jerror_clear() \
-  do {                 \
-    has_err = 0;       \
-    err_msg[0] = 0;    \
-  } while (0)
-#define jerror_log(fmt, ...)                \
-  do {                                      \
-    has_err = 1;                            \
-    sprintf(err_msg, (fmt), ##__VA_ARGS__); \
+/* Error state is per thread, so concurrent callers never race on it. A
+ * successful call costs a single store, the message is only formatted on
+ * the failure path. */
+#define jerror_clear() (jerr_last.code = JERR_NONE)
+#define jerror_log(code, fmt, ...) jerror_set((code), (fmt), ##__VA_ARGS__)
+
+/* Run cleanup code without losing the error it follows. */
+#define jerror_keep(...)           \
+  do {                             \
+    jerr_t jerr_kept_ = jerr_last; \
+    __VA_ARGS__;                   \
+    jerr_last = jerr_kept_;        \
   } while (0)
 
-static int has_err = 0;
-static char err_msg[MSG_BUFFER_LEN];
+static _Thread_local jerr_t jerr_last;
+
+static void jerror_set(jerrcode_t code, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  jerr_last.code = code;
+  jerr_last.offset = 0;
+  jerr_last.line = jerr_last.col = 0;
+  vsnprintf(jerr_last.msg, sizeof(jerr_last.msg), fmt, args);
+  va_end(args);
+}
+
+/* Attach an input position to the error just logged. */
+static void jerror_locate(size_t offset, int line, int col) {
+  jerr_last.offset = offset;
+  jerr_last.line = line;
+  jerr_last.col = col;
+}
+
+const char* jerror() { return jerr_last.code ? jerr_last.msg : 0; }
 
-const char* jerror() { return has_err ? err_msg : 0; }
+const jerr_t* jerror_detail() { return jerr_last.code ? &jerr_last : 0; }
 
 /* =======================
  *          UTILS
@@ -39,13 +85,13 @@ const char* jerror() { return has_err ? err_msg : 0; }
 //   do {                                       \
 //     if (!(expr)) jabort(fmt, ##__VA_ARGS__); \
 //   } while (0)
-#define check_type(node, type, ret, ...)                      \
-  do {                                                        \
-    if (!jis_##type(node)) {                                  \
-      jerror_log("Expect type '%s' but got type '%s'", #type, \
-                 type_str[jtype(node)]);                      \
-      ##__VA_ARGS__ return ret;                               \
-    }                                                         \
+#define check_type(node, type, ret, ...)                         \
+  do {                                                           \
+    if (!jis_##type(node)) {                                     \
+      jerror_log(JERR_TYPE, "Expect type '%s' but got type '%s'", \
+                 #type, type_str[jtype(node)]);                  \
+      ##__VA_ARGS__ return ret;                                  \
+    }                                                            \
   } while (0)
 #define grow_capacity(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
@@ -54,26 +100,183 @@ static const char* type_str[] = {
     [JSTRING] = "string", [JARRAY] = "array",     [JOBJECT] = "object",
 };
 
+#ifndef SJSON_NO_PARALLEL
+static int jcpu_count() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
+#endif
+
 static void* reallocate(void* ptr, int old, int new) {
-  jerror_clear();
   if (!new) {
     free(ptr);
     return 0;
   } else if (!old) {
     if (!(ptr = malloc(new))) {
-      jerror_log("Insufficient memory.");
+      jerror_log(JERR_MEMORY, "Insufficient memory.");
       return 0;
     }
     return ptr;
   } else {
     if (!(ptr = realloc(ptr, new))) {
-      jerror_log("Insufficient memory.");
+      jerror_log(JERR_MEMORY, "Insufficient memory.");
       return 0;
     }
     return ptr;
   }
 }
 
+#ifndef SJSON_NO_PARALLEL
+typedef struct jparallel {
+  void (*task)(void* ctx, int index);
+  void* ctx;
+  int ntasks;
+  atomic_int next;
+} jparallel_t;
+
+static void* jparallel_worker(void* arg) {
+  jparallel_t* par = arg;
+  int i;
+  while ((i = atomic_fetch_add(&par->next, 1)) < par->ntasks)
+    par->task(par->ctx, i);
+  return 0;
+}
+
+/* Run `task` once for every index in [0, ntasks) on up to `threads` threads,
+ * the caller being one of them. Tasks are handed out one at a time, so
+ * uneven tasks still balance. When threads cannot be started the remaining
+ * work simply runs on the caller. */
+static void jparallel_for(int ntasks, int threads,
+                          void (*task)(void* ctx, int index), void* ctx) {
+  jparallel_t par = {.task = task, .ctx = ctx, .ntasks = ntasks};
+  atomic_init(&par.next, 0);
+  if (threads > ntasks) threads = ntasks;
+
+  pthread_t* workers = 0;
+  int started = 0;
+  if (threads > 1) workers = malloc((threads - 1) * sizeof(pthread_t));
+  while (workers && started < threads - 1 &&
+         !pthread_create(&workers[started], 0, jparallel_worker, &par))
+    started++;
+  jparallel_worker(&par);
+  for (int i = 0; i < started; i++) pthread_join(workers[i], 0);
+  free(workers);
+}
+#endif
+
+#define jswar_ones 0x0101010101010101ull
+#define jswar_highs 0x8080808080808080ull
+#define jswar_haszero(w) (((w) - jswar_ones) & ~(w) & jswar_highs)
+#define jswar_hasless(w, n) (((w) - jswar_ones * (n)) & ~(w) & jswar_highs)
+#define jswar_hasbyte(w, c) jswar_haszero((w) ^ (jswar_ones * (c)))
+#define jspan_special(c, utf8) \
+  ((c) == '"' || (c) == '\\' || (c) < 0x20 || ((utf8) && (c) >= 0x80))
+
+/* Whether 8 string bytes need no attention: no quote, no backslash, no
+ * control character, and no multi-byte sequence when UTF-8 is checked. */
+static inline int jswar_plain(const char* p, int utf8) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  uint64_t special = jswar_hasbyte(w, '"') | jswar_hasbyte(w, '\\') |
+                     jswar_hasless(w, 0x20);
+  if (utf8) special |= w & jswar_highs;
+  return !special;
+}
+
+/* First byte of [p, end) that is a quote, a backslash or a control
+ * character, or with `utf8` set, not ASCII. Return `end` when there is none.
+ * Shared by string scanning and escaping, so both skip plain runs 32, 16 or
+ * 8 bytes at a time. */
+static inline const char* jspan_plain(const char* p, const char* end,
+                                      int utf8) {
+#if defined(__AVX2__)
+  const __m256i quote32 = _mm256_set1_epi8('"');
+  const __m256i slash32 = _mm256_set1_epi8('\\');
+  const __m256i ctrl32 = _mm256_set1_epi8(0x1F);
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote32),
+                        _mm256_cmpeq_epi8(v, slash32)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl32), v));
+    unsigned mask = _mm256_movemask_epi8(hit);
+    if (utf8) mask |= _mm256_movemask_epi8(v);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i slash = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1F);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));  // v <= 0x1F
+    unsigned mask = _mm_movemask_epi8(hit);
+    if (utf8) mask |= _mm_movemask_epi8(v);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (end - p >= 8 && jswar_plain(p, utf8)) p += 8;
+  while (p < end && !jspan_special((unsigned char)*p, utf8)) p++;
+  return p;
+}
+
+/* First byte of [p, end) that is a quote or a bracket, or `end`. Setting
+ * bit 0x20 maps '[' onto '{' and ']' onto '}', and no other byte onto
+ * either, so two comparisons find all four brackets. */
+static inline const char* jspan_structural(const char* p, const char* end) {
+#if defined(__AVX2__)
+  const __m256i quote32 = _mm256_set1_epi8('"');
+  const __m256i open32 = _mm256_set1_epi8('{');
+  const __m256i close32 = _mm256_set1_epi8('}');
+  const __m256i fold32 = _mm256_set1_epi8(0x20);
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i folded = _mm256_or_si256(v, fold32);
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(folded, open32),
+                        _mm256_cmpeq_epi8(folded, close32)),
+        _mm256_cmpeq_epi8(v, quote32));
+    unsigned mask = _mm256_movemask_epi8(hit);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  const __m128i fold = _mm_set1_epi8(0x20);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i folded = _mm_or_si128(v, fold);
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                     _mm_cmpeq_epi8(folded, close)),
+        _mm_cmpeq_epi8(v, quote));
+    unsigned mask = _mm_movemask_epi8(hit);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (end - p >= 8) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    uint64_t folded = w | jswar_ones * 0x20;
+    if (jswar_hasbyte(folded, '{') | jswar_hasbyte(folded, '}') |
+        jswar_hasbyte(w, '"'))
+      break;
+    p += 8;
+  }
+  while (p < end && *p != '"' && (*p | 0x20) != '{' && (*p | 0x20) != '}')
+    p++;
+  return p;
+}
+
 /* Main hash function for hash table */
 static unsigned int fnv1a(const char* str) {
   unsigned int hash = 2166136261u;
@@ -98,7 +301,16 @@ static unsigned int fnv1a(const char* str) {
 #define jvector_pop(type, v, len) \
   jcast(tvector_pop(jcast((v), tv*), (len), sizeof(type)), type*)
 #define jvector_remove(type, v, index, len) \
-  jcast(tvector_remove(jcast((v), tv*), (index), (len), sizeof(type)), type*)
+  tvector_remove(jas_tv((v)), (index), (len), sizeof(type))
+#define jvector_splice(type, v, index, remove, value, insert)      \
+  tvector_splice(jas_tv((v)), (index), (remove), (value), (insert), \
+                 sizeof(type))
+#define jvector_grow(type, v, len) \
+  tvector_grow(jas_tv((v)), (len), sizeof(type))
+#define jvector_reserve(type, v, capacity) \
+  tvector_reserve(jas_tv((v)), (capacity), sizeof(type))
+#define jvector_shrink(type, v, capacity) \
+  tvector_shrink(jas_tv((v)), (capacity), sizeof(type))
 
 /* Template */
 typedef struct tvector {
@@ -108,25 +320,50 @@ typedef struct tvector {
 } tv;
 
 static void tvector_init(tv* v) {
-  jerror_clear();
   v->len = v->capacity = 0;
   v->data = 0;
 }
 
 static void tvector_free(tv* v) {
-  jerror_clear();
   reallocate(v->data, 0, 0);
 }
 
+/* Make room for `len` elements, growing geometrically. On failure the
+ * vector is left as it was. */
+static int tvector_grow(tv* v, int len, int typesz) {
+  if (len <= v->capacity) return 1;
+  int capacity = v->capacity;
+  while (len > capacity) capacity = grow_capacity(capacity);
+  void* data = reallocate(v->data, v->capacity * typesz, capacity * typesz);
+  if (!data) return 0;
+  v->data = data;
+  v->capacity = capacity;
+  return 1;
+}
+
+/* Room for exactly `capacity` elements, for callers who know the size. */
+static int tvector_reserve(tv* v, int capacity, int typesz) {
+  if (capacity <= v->capacity) return 1;
+  void* data = reallocate(v->data, v->capacity * typesz, capacity * typesz);
+  if (!data) return 0;
+  v->data = data;
+  v->capacity = capacity;
+  return 1;
+}
+
+/* Release the room beyond `capacity`, which is at least the length. */
+static int tvector_shrink(tv* v, int capacity, int typesz) {
+  if (capacity >= v->capacity) return 1;
+  void* data = reallocate(v->data, v->capacity * typesz, capacity * typesz);
+  if (!data && capacity) return 0;
+  v->data = data;
+  v->capacity = capacity;
+  return 1;
+}
+
 static int tvector_add(tv* v, const void* value, int len, int typesz) {
-  jerror_clear();
-  if (v->len + len > v->capacity) {
-    int old = v->capacity * typesz;
-    while (v->len + len > v->capacity) v->capacity = grow_capacity(v->capacity);
-    int new = v->capacity * typesz;
-    v->data = reallocate(v->data, old, new);
-    if (!v->data) return 0;
-  }
+  if (!len) return 1;
+  if (!tvector_grow(v, v->len + len, typesz)) return 0;
 
   void* target = v->data + v->len * typesz;
   memcpy(target, value, typesz * len);
@@ -137,70 +374,55 @@ static int tvector_add(tv* v, const void* value, int len, int typesz) {
 /* Popped value will remain at the end of the vector until next write.
  * User should maintain those contents. */
 static void* tvector_pop(tv* v, int len, int typesz) {
-  jerror_clear();
   v->len -= len;
   if (v->len < 0) v->len = 0;
   return v->data + v->len * typesz;
 }
 
-static int tvector_right_shift(tv* v, int index, int distance, int typesz) {
-  jerror_clear();
-  if (v->len == 0) return 1;
-
-  // Ensure there is enough memory
-  const void* last_item = v->data + (v->len - 1) * typesz;
-  if (!tvector_add(v, last_item, distance, typesz)) return 0;
-
-  // Shifting
-  int len = v->len - index;
-  const void* start = v->data + index * typesz;
-  void* target = v->data + (index + distance) * typesz;
-  memmove(target, start, len * typesz);
+static int tvector_check_splice(tv* v, int index, int remove, int insert) {
+  if (index < 0 || index > v->len) {
+    jerror_log(JERR_INDEX, "Invalid index '%d'.", index);
+    return 0;
+  }
+  if (remove < 0 || insert < 0 || remove > v->len - index) {
+    jerror_log(JERR_INDEX, "Invalid range [%d, %d).", index, index + remove);
+    return 0;
+  }
   return 1;
 }
 
-/* Overwritten contents will be swapped to the end of the vector until next
- * write. User should maintain those contents. */
-static void* tvector_left_shift(tv* v, int index, int distance, int typesz) {
-  jerror_clear();
-  if (index < distance) distance = index;
-
-  // Byte2Byte Swapping
-  int len = v->len - index;
-  unsigned char* start = v->data + index * typesz;
-  unsigned char* target = v->data + (index - distance) * typesz;
-  for (int i = 0; i < len * typesz; i++) {
-    unsigned char t = target[i];
-    target[i] = start[i];
-    start[i] = t;
-  }
+/* Replace `remove` elements at `index` with `insert` elements of `value`,
+ * growing at most once and moving the tail with a single memmove. Removed
+ * contents are overwritten, so read them first. */
+static int tvector_splice(tv* v, int index, int remove, const void* value,
+                          int insert, int typesz) {
+  if (!tvector_check_splice(v, index, remove, insert)) return 0;
+  if (!tvector_grow(v, v->len - remove + insert, typesz)) return 0;
 
-  v->len -= distance;
-  return v->data + v->len * typesz;
+  int tail = v->len - index - remove;
+  void* start = v->data + index * typesz;
+  if (remove != insert)
+    memmove(start + insert * typesz, start + remove * typesz, tail * typesz);
+  if (insert) memcpy(start, value, insert * typesz);
+  v->len += insert - remove;
+  return 1;
 }
 
 static int tvector_insert(tv* v, int index, const void* value, int len,
                           int typesz) {
-  jerror_clear();
   if (index < 0 || index >= v->len) {
-    jerror_log("Invalid index '%d'.", index);
+    jerror_log(JERR_INDEX, "Invalid index '%d'.", index);
     return 0;
   }
-  if (!tvector_right_shift(v, index, len, typesz)) return 0;
-  void* start = v->data + index * typesz;
-  memcpy(start, value, len * typesz);
-  return 1;
+  return tvector_splice(v, index, 0, value, len, typesz);
 }
 
-/* Removed value will remain at the end of the vector until next write.
- * User should maintain those contents. */
-static void* tvector_remove(tv* v, int index, int len, int typesz) {
-  jerror_clear();
+static int tvector_remove(tv* v, int index, int len, int typesz) {
   if (index < 0 || index >= v->len) {
-    jerror_log("Invalid index '%d'.", index);
+    jerror_log(JERR_INDEX, "Invalid index '%d'.", index);
     return 0;
   }
-  return tvector_left_shift(v, index + len, len, typesz);
+  return tvector_splice(v, index, len, 0, 0, typesz);
 }
 
 /* ==============================
@@ -216,10 +438,16 @@ static void* tvector_remove(tv* v, int index, int len, int typesz) {
 #define jht_index(ht, key) (fnv1a(key) % jht_capacity(ht))
 #define jht_head(ht, key) jvector_get((ht), jht_index((ht), key))
 
-static int jht_init(tv* ht) {
-  jerror_clear();
+/* Fewest buckets for `size` entries, at most one per bucket on average. */
+static int jht_capacity_for(int size) {
+  int capacity = jht_capacity_grow(0);
+  while (capacity < size) capacity = jht_capacity_grow(capacity);
+  return capacity;
+}
+
+static int jht_init(tv* ht, int capacity) {
   jvector_init(jkv_t, ht);
-  ht->capacity = jht_capacity_grow(ht->capacity);
+  ht->capacity = capacity;
   int new = ht->capacity * sizeof(jkv_t);
   ht->data = reallocate(0, 0, new);
   if (!ht->data) return 0;
@@ -227,15 +455,14 @@ static int jht_init(tv* ht) {
   return 1;
 }
 
+/* Values are not touched, they are released by the traversal in jdelete. */
 static void jht_free(tv* ht) {
-  jerror_clear();
   for (int i = 0; i < ht->capacity; i++) {
     jkv_t* head = ht->data + i * sizeof(jkv_t);
     while (head->next) {
       jkv_t* entry = head->next;
       head->next = entry->next;
 
-      jdelete(entry->value);
       reallocate(entry->key, 0, 0);
       reallocate(entry, sizeof(jkv_t), 0);
     }
@@ -244,9 +471,8 @@ static void jht_free(tv* ht) {
   jvector_free(jkv_t, ht);
 }
 
-static int jht_grow(tv* ht) {
-  jerror_clear();
-  tv new_ht = {.len = ht->len, .capacity = jht_capacity_grow(ht->capacity)};
+static int jht_resize(tv* ht, int capacity) {
+  tv new_ht = {.len = ht->len, .capacity = capacity};
   new_ht.data = reallocate(0, 0, new_ht.capacity * sizeof(jkv_t));
   if (!new_ht.data) return 0;
   memset(new_ht.data, 0, new_ht.capacity * sizeof(jkv_t));
@@ -273,912 +499,5255 @@ static int jht_grow(tv* ht) {
   return 1;
 }
 
-/* ==============================
- *       API IMPLEMENTATION
- * ============================== */
+static int jht_grow(tv* ht) {
+  return jht_resize(ht, jht_capacity_grow(ht->capacity));
+}
 
 /* ==============================
- *          1. TO_STRING
+ *      TRACKING OPERATION
  * ============================== */
 
-static int jnull_to_string(jnode_t* jnode, tv* jstr);
-static int jbool_to_string(jnode_t* jnode, tv* jstr);
-static int jnumber_to_string(jnode_t* jnode, tv* jstr);
-static int jstring_to_string(jnode_t* jnode, tv* jstr);
-static int jarray_to_string(jnode_t* jnode, tv* jstr);
-static int jobject_to_string(jnode_t* jnode, tv* jstr);
+/* Changes are tracked so that cached output and hashes can be reused. The
+ * invariants: every cached ancestor of a dirty node is dirty as well, and
+ * every descendant of a hashed node is hashed as well. */
 
-static int (*jto_strings[])(jnode_t*, tv*) = {
-    [JNULL] = jnull_to_string,     [JBOOLEAN] = jbool_to_string,
-    [JNUMBER] = jnumber_to_string, [JSTRING] = jstring_to_string,
-    [JARRAY] = jarray_to_string,   [JOBJECT] = jobject_to_string,
+enum jnode_flag {
+  JNODE_DIRTY = 1 << 0,   // changed since its output was last cached
+  JNODE_HASHED = 1 << 1,  // unchanged since its hash was last kept
 };
 
-static int jnull_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  return jvector_concat(char, jstr, "null", 4);
-}
-
-static int jbool_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  check_type(jnode, boolean, 0);
-  jbool_t* jbool = jas_bool(jnode);
-  if (jbool->value) {
-    return jvector_concat(char, jstr, "true", 4);
-  } else {
-    return jvector_concat(char, jstr, "false", 5);
+/* The prefix shared by every node except the null and boolean singletons. */
+typedef struct jlinked {
+  jtype_t type;
+  int flags;
+  jnode_t* parent;
+} jlinked_t;
+
+typedef struct jcache {
+  int flags;  // JWRITE_* flags of the output, -1 before the first
+  jvector(char, bytes);
+  uint64_t hash;  // valid while the node is hashed
+} jcache_t;
+
+#define jis_linked(node) (jtype(node) >= JNUMBER)
+#define jas_linked(node) jcast((node), jlinked_t*)
+#define jcache_of(node)                                  \
+  (jis_array(node)    ? jas_array(node)->cache           \
+   : jis_object(node) ? jas_object(node)->cache : 0)
+
+/* Mark `jnode` and its ancestors dirty and not hashed. By the invariants
+ * everything above a node which is already both is both too, so the walk
+ * stops there. */
+static void jnode_touch(jnode_t* jnode) {
+  while (jnode &&
+         (jas_linked(jnode)->flags & (JNODE_DIRTY | JNODE_HASHED)) !=
+             JNODE_DIRTY) {
+    jas_linked(jnode)->flags |= JNODE_DIRTY;
+    jas_linked(jnode)->flags &= ~JNODE_HASHED;
+    jnode = jas_linked(jnode)->parent;
   }
 }
 
-static int jnumber_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  check_type(jnode, number, 0);
-  jnumber_t* jnum = jas_number(jnode);
-  char buffer[64];
-  int len = sprintf(buffer, "%g", jnum->value);
-  return jvector_concat(char, jstr, buffer, len);
+static void jcache_free(jcache_t* cache) {
+  if (!cache) return;
+  jvector_free(char, &cache->bytes);
+  reallocate(cache, sizeof(jcache_t), 0);
 }
 
-static int jstring_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstring = jas_string(jnode);
-  if (!jvector_concat(char, jstr, "\"", 1)) return 0;
-  if (!jvector_concat(char, jstr, jvector_data(jstring->string),
-                      jvector_len(jstring->string)))
-    return 0;
-  return jvector_concat(char, jstr, "\"", 1);
+/* `child` was moved into `parent`. */
+static void jnode_adopt(jnode_t* parent, jnode_t* child) {
+  if (child && jis_linked(child)) jas_linked(child)->parent = parent;
+  jnode_touch(parent);
 }
 
-static int jarray_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarray = jas_array(jnode);
-  if (!jvector_concat(char, jstr, "[", 1)) return 0;
-
-  jnode_t* item = *jvector_get(jarray->array, 0);
-  if (!jto_strings[item->type](item, jas_tv(jstr))) return 0;
-  for (int i = 1; i < jvector_len(jarray->array); i++) {
-    jvector_concat(char, jstr, ", ", 2);
-    jnode_t* item = *jvector_get(jarray->array, i);
-    if (!jto_strings[item->type](item, jas_tv(jstr))) return 0;
-  }
+/* ==============================
+ *      TRAVERSAL OPERATION
+ * ============================== */
 
-  return jvector_concat(char, jstr, "]", 1);
+#define JWALK_INLINE_DEPTH 32
+
+typedef struct jwalk_frame {
+  jvisit_t visit;
+  int next;     // index of the next child
+  int bucket;   // object only, bucket of `kv`
+  jkv_t* kv;    // object only, last visited entry
+  int order;    // sorted walk only, first entry of the object in `keys`
+} jwalk_frame_t;
+
+/* An object member in key order. The first 8 key bytes, big-endian, decide
+ * most comparisons without touching the key. */
+typedef struct jwalk_key {
+  uint64_t prefix;
+  jkv_t* kv;
+} jwalk_key_t;
+
+/* Explicit traversal stack. Shallow trees never touch the heap. */
+typedef struct jwalk {
+  int len;
+  int capacity;
+  jwalk_frame_t* data;
+  int sorted;
+  jvector(jwalk_key_t, keys);  // member order of every open object, stacked
+  jwalk_frame_t local[JWALK_INLINE_DEPTH];
+} jwalk_t;
+
+static int jwalk_key_cmp(const void* a, const void* b) {
+  const jwalk_key_t* x = a;
+  const jwalk_key_t* y = b;
+  if (x->prefix != y->prefix) return x->prefix < y->prefix ? -1 : 1;
+  return strcmp(x->kv->key, y->kv->key);
 }
 
-static int jobject_to_string(jnode_t* jnode, tv* jstr) {
-  jerror_clear();
-  check_type(jnode, object, 0);
-  jobject_t* jobj = jas_object(jnode);
-  if (!jvector_concat(char, jstr, "{", 1)) return 0;
-
-  // iterating items
-  int count = 0;
+/* Append the members of `jobj` to `keys` in byte-wise key order. */
+static int jwalk_sort(tv* keys, jobject_t* jobj) {
+  int first = keys->len;
   for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
-    jkv_t* head = jht_get(jobj->hashmap, i);
-    for (const jkv_t* it = head->next; it; it = it->next) {
-      count++;
-
-      int len = strlen(it->key);
-      if (!jvector_concat(char, jstr, "\"", 1)) return 0;
-      if (!jvector_concat(char, jstr, it->key, len)) return 0;
-      if (!jvector_concat(char, jstr, "\": ", 3)) return 0;
-
-      jnode_t* item = it->value;
-      if (!jto_strings[item->type](item, jas_tv(jstr))) return 0;
-      if (count < jht_size(jobj->hashmap))
-        if (!jvector_concat(char, jstr, ", ", 2)) return 0;
+    for (jkv_t* kv = jht_get(jobj->hashmap, i)->next; kv; kv = kv->next) {
+      jwalk_key_t key = {.kv = kv};
+      const unsigned char* k = (const unsigned char*)kv->key;
+      for (int j = 0; j < 8; j++) {
+        key.prefix = key.prefix << 8 | *k;
+        if (*k) k++;
+      }
+      if (!jvector_concat(jwalk_key_t, keys, &key, 1)) return 0;
     }
   }
-
-  return jvector_concat(char, jstr, "}", 1);
+  qsort((jwalk_key_t*)keys->data + first, keys->len - first,
+        sizeof(jwalk_key_t), jwalk_key_cmp);
+  return 1;
 }
 
-char* jto_string(jnode_t* jnode) {
-  jerror_clear();
-  jvector(char, jstr);
-  jvector_init(char, &jstr);
-  if (jto_strings[jnode->type](jnode, jas_tv(&jstr))) {
-    if (!jvector_concat(char, &jstr, "\0", 1)) return 0;
-    return jvector_data(jstr);
-  } else {
-    return 0;
+static int jwalk_push(jwalk_t* walk, const jvisit_t* visit) {
+  if (walk->len == walk->capacity) {
+    int old = walk->capacity * sizeof(jwalk_frame_t);
+    int new = grow_capacity(walk->capacity) * sizeof(jwalk_frame_t);
+    jwalk_frame_t* data;
+    if (walk->data == walk->local) {
+      data = reallocate(0, 0, new);
+      if (data) memcpy(data, walk->local, old);
+    } else {
+      data = reallocate(walk->data, old, new);
+    }
+    if (!data) return 0;
+    walk->data = data;
+    walk->capacity = grow_capacity(walk->capacity);
   }
+  int order = jvector_len(walk->keys);
+  if (walk->sorted && jis_object(visit->node) &&
+      !jwalk_sort(jas_tv(&walk->keys), jas_object(visit->node)))
+    return 0;
+  walk->data[walk->len++] =
+      (jwalk_frame_t){.visit = *visit, .bucket = -1, .order = order};
+  return 1;
 }
 
-/* ==============================
- *       2. NODE OPERATION
- * ============================== */
-
-jnode_t* jnull_new() {
-  jerror_clear();
-  static jnull_t jnull_ = {.type = JNULL};
-  return jcast(&jnull_, jnode_t*);
-}
+/* Fill `child` with the next child of the frame, return 0 when exhausted. */
+static int jwalk_next(jwalk_t* walk, jwalk_frame_t* frame, jvisit_t* child) {
+  jnode_t* node = frame->visit.node;
+  *child = (jvisit_t){.parent = node,
+                      .index = frame->next,
+                      .depth = frame->visit.depth + 1};
+  if (jis_array(node)) {
+    jarray_t* jarr = jas_array(node);
+    if (frame->next >= jvector_len(jarr->array)) return 0;
+    child->node = *jvector_get(jarr->array, frame->next++);
+    return 1;
+  }
 
-jnode_t* jbool_new(int value) {
-  jerror_clear();
-  static jbool_t jtrue_ = {.type = JBOOLEAN, .value = 1};
-  static jbool_t jfalse_ = {.type = JBOOLEAN, .value = 0};
-  if (value) {
-    return jcast(&jtrue_, jnode_t*);
+  jkv_t* kv = 0;
+  if (walk->sorted) {
+    int i = frame->order + frame->next;
+    if (i < jvector_len(walk->keys)) kv = jvector_get(walk->keys, i)->kv;
   } else {
-    return jcast(&jfalse_, jnode_t*);
+    jobject_t* jobj = jas_object(node);
+    kv = frame->kv ? frame->kv->next : 0;
+    while (!kv && ++frame->bucket < jht_capacity(jobj->hashmap))
+      kv = jht_get(jobj->hashmap, frame->bucket)->next;
   }
+  if (!kv) return 0;
+  frame->kv = kv;
+  frame->next++;
+  child->node = kv->value;
+  child->key = kv->key;
+  return 1;
 }
 
-jnode_t* jnumber_new(double value) {
-  jerror_clear();
-  jnumber_t* jnum = reallocate(0, 0, sizeof(jnumber_t));
-  if (!jnum) return 0;
-  jnum->type = JNUMBER;
-  jnum->value = value;
-  return jcast(jnum, jnode_t*);
+static int jwalk_enter(jwalk_t* walk, const jvisit_t* visit, jvisitor_t pre,
+                       jvisitor_t post, void* ctx) {
+  int ret = pre ? pre(visit, ctx) : JWALK_CONTINUE;
+  if (ret == JWALK_ABORT) return 0;
+  if (ret == JWALK_SKIP) return 1;
+  if (jis_array(visit->node) || jis_object(visit->node))
+    return jwalk_push(walk, visit);
+  return post ? post(visit, ctx) : 1;
 }
 
-jnode_t* jstring_new(int len, const char* string) {
-  jerror_clear();
-  jstring_t* jstr = reallocate(0, 0, sizeof(jstring_t));
-  if (!jstr) return 0;
-  jstr->type = JSTRING;
-  jvector_init(char, &jstr->string);
-  if (!len) len = strlen(string);
-  if (!jvector_concat(char, &jstr->string, string, len)) {
-    reallocate(jstr, sizeof(jstring_t), 0);
-    return 0;
+/* jwalk() which can visit object members in byte-wise key order. */
+static int jwalk_ex(jnode_t* jnode, jvisitor_t pre, jvisitor_t post,
+                    void* ctx, int sorted) {
+  jwalk_t walk = {.capacity = JWALK_INLINE_DEPTH, .sorted = sorted};
+  walk.data = walk.local;
+  jvector_init(jwalk_key_t, &walk.keys);
+
+  jvisit_t visit = {.node = jnode};
+  int ok = jwalk_enter(&walk, &visit, pre, post, ctx);
+  while (ok && walk.len) {
+    jwalk_frame_t* frame = walk.data + walk.len - 1;
+    if (jwalk_next(&walk, frame, &visit)) {
+      ok = jwalk_enter(&walk, &visit, pre, post, ctx);
+    } else {
+      visit = frame->visit;
+      walk.keys.len = frame->order;
+      walk.len--;
+      ok = post ? post(&visit, ctx) : 1;
+    }
   }
-  return jcast(jstr, jnode_t*);
-}
 
-jnode_t* jarray_new() {
-  jerror_clear();
-  jarray_t* jarray = reallocate(0, 0, sizeof(jarray_t));
-  if (!jarray) return 0;
-  jarray->type = JARRAY;
-  jvector_init(jnode_t, &jarray->array);
-  return jcast(jarray, jnode_t*);
+  if (walk.data != walk.local) reallocate(walk.data, 0, 0);
+  jvector_free(jwalk_key_t, &walk.keys);
+  return ok;
 }
 
-jnode_t* jobject_new() {
+int jwalk(jnode_t* jnode, jvisitor_t pre, jvisitor_t post, void* ctx) {
   jerror_clear();
-  jobject_t* jobj = reallocate(0, 0, sizeof(jobject_t));
-  if (!jobj) return 0;
-  jobj->type = JOBJECT;
-  if (!jht_init(jas_tv(&jobj->hashmap))) {
-    reallocate(jobj, sizeof(jobject_t), 0);
-    return 0;
-  }
-  return jcast(jobj, jnode_t*);
+  return jwalk_ex(jnode, pre, post, ctx, 0);
 }
 
-void jdelete(jnode_t* jnode) {
-  jerror_clear();
-  if (!jnode) return;
-  switch (jnode->type) {
-    case JNULL: break;
-    case JBOOLEAN: break;
-    case JNUMBER: reallocate(jnode, sizeof(jnumber_t), 0); break;
-    case JSTRING: {
-      jstring_t* jstr = jas_string(jnode);
-      jvector_free(char, &jstr->string);
-      reallocate(jstr, sizeof(jstring_t), 0);
+/* ==============================
+ *         QUERY STEPS
+ * ============================== */
+
+/* A query is compiled into a list of steps applied from the root. Keys are
+ * unescaped and hashed at compile time, so running a query only walks
+ * buckets and compares keys. Steps drive both path queries and projection
+ * parsing. */
+
+enum jstep_kind {
+  JSTEP_MEMBER = 0,  // pointer token: object key, or array index when numeric
+  JSTEP_KEY,         // object member
+  JSTEP_INDEX,       // array element, negative counts from the end
+  JSTEP_ALL,         // every member of an array or object
+  JSTEP_DESCEND,     // the node itself and all of its descendants
+};
+
+typedef struct jstep {
+  int kind;
+  int index;          // token read as an index, -1 when it is not one
+  int len;            // bytes of `key`
+  unsigned int hash;  // fnv1a() of `key`
+  char* key;          // 0 unless the step names a key
+} jstep_t;
+
+struct jpath {
+  int single;  // no wildcard or descent, so at most one match
+  jvector(jstep_t, steps);
+};
+
+/* ==============================
+ *       API IMPLEMENTATION
+ * ============================== */
+
+/* ==============================
+ *          1. TO_STRING
+ * ============================== */
+
+/* Hand the buffered bytes to the target. */
+static int jsink_drain(jsink_t* sink) {
+  switch (sink->kind) {
+    case JSINK_BOUNDED: return 1;
+    case JSINK_FD: {
+      for (size_t done = 0; done < sink->len;) {
+        ssize_t n = write(sink->to.fd, sink->buf + done, sink->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto fail;
+        done += n;
+      }
       break;
     }
-    case JARRAY: {
-      jarray_t* jarray = jas_array(jnode);
-      jvector_foreach(i, jarray->array) {
-        jnode_t* item = *jvector_get(jarray->array, i);
-        jdelete(item);
-      }
-      jvector_free(jnode_t, &jarray->array);
-      reallocate(jarray, sizeof(jarray_t), 0);
+    case JSINK_FILE: {
+      if (fwrite(sink->buf, 1, sink->len, sink->to.file) != sink->len)
+        goto fail;
       break;
     }
-    case JOBJECT: {
-      jobject_t* jobj = jas_object(jnode);
-      jht_free(jas_tv(&jobj->hashmap));
-      reallocate(jobj, sizeof(jobject_t), 0);
+    case JSINK_CALLBACK: {
+      if (sink->len &&
+          !sink->to.user.callback(sink->buf, sink->len, sink->to.user.ctx))
+        goto fail;
       break;
     }
   }
+  sink->len = 0;
+  return 1;
+
+fail:
+  jerror_log(JERR_IO, "Failed to write output.");
+  return 0;
 }
 
-/* ==============================
- *      3. STRING OPERATION
- * ============================== */
+static int jsink_write_slow(jsink_t* sink, const char* data, size_t len) {
+  if (sink->kind == JSINK_BOUNDED) {
+    size_t n = sink->cap - sink->len;
+    if (n) memcpy(sink->buf + sink->len, data, n);
+    sink->len += n;
+    sink->to.dropped += len - n;
+    return 1;
+  }
+  while (sink->cap - sink->len < len) {
+    size_t n = sink->cap - sink->len;
+    if (n) memcpy(sink->buf + sink->len, data, n);
+    sink->len += n;
+    data += n;
+    len -= n;
+    if (!jsink_drain(sink)) return 0;
+  }
+  memcpy(sink->buf + sink->len, data, len);
+  sink->len += len;
+  return 1;
+}
 
-int jstring_len(jnode_t* jnode) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  return jvector_len(jstr->string);
+/* Serializers only write through here, the common case being one compare
+ * and one memcpy. */
+static inline int jsink_write(jsink_t* sink, const char* data, size_t len) {
+  if (sink->cap - sink->len < len) return jsink_write_slow(sink, data, len);
+  memcpy(sink->buf + sink->len, data, len);
+  sink->len += len;
+  return 1;
 }
 
-char jstring_get(jnode_t* jnode, int index) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  return *jvector_get(jstr->string, index);
+static void jsink_init(jsink_t* sink, int kind, char* buf, size_t cap) {
+  sink->kind = kind;
+  sink->len = 0;
+  if (buf && cap) {
+    sink->buf = buf;
+    sink->cap = cap;
+  } else {
+    sink->buf = sink->local;
+    sink->cap = sizeof(sink->local);
+  }
 }
 
-const char* jstring_content(jnode_t* jnode) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  return jvector_data(jstr->string);
+/* With no buffer at all the sink only measures. */
+static void jsink_init_bounded(jsink_t* sink, char* buf, size_t cap) {
+  sink->kind = JSINK_BOUNDED;
+  sink->buf = buf;
+  sink->len = 0;
+  sink->cap = cap;
+  sink->to.dropped = 0;
 }
 
-int jstring_add(jnode_t* jnode, char c) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  return jvector_concat(char, &jstr->string, &c, 1);
+void jsink_init_fd(jsink_t* sink, int fd, char* buf, size_t cap) {
+  jsink_init(sink, JSINK_FD, buf, cap);
+  sink->to.fd = fd;
 }
 
-int jstring_insert(jnode_t* jnode, int index, char c) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  return jvector_insert(char, &jstr->string, index, &c, 1);
+void jsink_init_file(jsink_t* sink, FILE* file, char* buf, size_t cap) {
+  jsink_init(sink, JSINK_FILE, buf, cap);
+  sink->to.file = file;
 }
 
-int jstring_concat(jnode_t* jnode, const char* string) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  int len = strlen(string);
-  return jvector_concat(char, &jstr->string, string, len);
+void jsink_init_callback(jsink_t* sink, jsink_callback_t callback, void* ctx,
+                         char* buf, size_t cap) {
+  jsink_init(sink, JSINK_CALLBACK, buf, cap);
+  sink->to.user.callback = callback;
+  sink->to.user.ctx = ctx;
 }
 
-int jstring_pop(jnode_t* jnode) {
+int jsink_put(jsink_t* sink, const char* data, size_t len) {
   jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  jvector_pop(char, &jstr->string, 1);
-  return 1;
+  return jsink_write(sink, data, len);
 }
 
-int jstring_remove(jnode_t* jnode, int index) {
+int jsink_flush(jsink_t* sink) {
   jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  jvector_remove(char, &jstr->string, index, 1);
-  return 1;
+  return jsink_drain(sink);
 }
 
-int jstring_truncate(jnode_t* jnode, int len) {
-  jerror_clear();
-  check_type(jnode, string, 0);
-  jstring_t* jstr = jas_string(jnode);
-  jvector_pop(char, &jstr->string, jvector_len(jstr->string) - len);
-  return 1;
+/* State of one serialization. A measuring pass can record number texts so
+ * that the writing pass replays them instead of formatting twice. */
+typedef struct jemitter {
+  jsink_t* sink;
+  int flags;   // JWRITE_* flags
+  int indent;  // spaces per level when pretty
+  int base;    // depth of the tree's root in the output
+  jnode_t* fill;  // container whose cache is being rebuilt
+  jnode_t* hole;  // container whose members are written elsewhere
+  size_t at;      // offset of the hole in the output
+  tv* numbers;  // each text behind its length byte, 0 to not cache
+  int replay;
+  int cursor;  // next text to replay
+} jemitter_t;
+
+/* Write a string body with quotes, backslashes and control characters
+ * escaped. Plain runs are found in bulk and copied with one write each. */
+static int jescape_write(jsink_t* sink, const char* s, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  const char* end = s + len;
+  for (;;) {
+    const char* p = jspan_plain(s, end, 0);
+    if (p > s && !jsink_write(sink, s, p - s)) return 0;
+    if (p == end) return 1;
+
+    unsigned char c = *p;
+    char esc[6] = {'\\', c};
+    int n = 2;
+    switch (c) {
+      case '"':
+      case '\\': break;
+      case '\b': esc[1] = 'b'; break;
+      case '\f': esc[1] = 'f'; break;
+      case '\n': esc[1] = 'n'; break;
+      case '\r': esc[1] = 'r'; break;
+      case '\t': esc[1] = 't'; break;
+      default: {
+        memcpy(esc + 1, "u00", 3);
+        esc[4] = hex[c >> 4];
+        esc[5] = hex[c & 0xF];
+        n = 6;
+      }
+    }
+    if (!jsink_write(sink, esc, n)) return 0;
+    s = p + 1;
+  }
 }
 
-/* ==============================
- *       4. ARRAY OPERATION
+static int jnull_to_string(jnode_t* jnode, jemitter_t* em);
+static int jbool_to_string(jnode_t* jnode, jemitter_t* em);
+static int jnumber_to_string(jnode_t* jnode, jemitter_t* em);
+static int jstring_to_string(jnode_t* jnode, jemitter_t* em);
+
+/* Containers are opened and closed by the traversal hooks. */
+static int (*jto_strings[])(jnode_t*, jemitter_t*) = {
+    [JNULL] = jnull_to_string,     [JBOOLEAN] = jbool_to_string,
+    [JNUMBER] = jnumber_to_string, [JSTRING] = jstring_to_string,
+};
+
+static int jnull_to_string(jnode_t* jnode, jemitter_t* em) {
+  return jsink_write(em->sink, "null", 4);
+}
+
+static int jbool_to_string(jnode_t* jnode, jemitter_t* em) {
+  check_type(jnode, boolean, 0);
+  jbool_t* jbool = jas_bool(jnode);
+  if (jbool->value) {
+    return jsink_write(em->sink, "true", 4);
+  } else {
+    return jsink_write(em->sink, "false", 5);
+  }
+}
+
+/* Numbers are formatted once. A measuring pass that records them lets the
+ * writing pass copy the text back. */
+static int jemit_number(jemitter_t* em, double value) {
+  if (em->replay) {
+    const char* text = (char*)em->numbers->data + em->cursor;
+    int len = (unsigned char)*text;
+    em->cursor += len + 1;
+    return jsink_write(em->sink, text + 1, len);
+  }
+
+  char buffer[64];
+  buffer[0] = sprintf(buffer + 1, "%g", value);
+  if (em->numbers &&
+      !jvector_concat(char, em->numbers, buffer, buffer[0] + 1))
+    return 0;
+  return jsink_write(em->sink, buffer + 1, buffer[0]);
+}
+
+static int jemit_string(jemitter_t* em, const char* s, size_t len) {
+  return jsink_write(em->sink, "\"", 1) && jescape_write(em->sink, s, len) &&
+         jsink_write(em->sink, "\"", 1);
+}
+
+static void jemitter_init(jemitter_t* em, jsink_t* sink,
+                          const jwrite_opts_t* opts) {
+  *em = (jemitter_t){.sink = sink, .indent = 2};
+  if (!opts) return;
+  em->flags = opts->flags;
+  if (opts->indent > 0) em->indent = opts->indent;
+}
+
+static int jemit_newline(jemitter_t* em, int depth) {
+  static const char spaces[] = "                                ";
+  if (!jsink_write(em->sink, "\n", 1)) return 0;
+  for (int n = depth * em->indent; n > 0; n -= sizeof(spaces) - 1) {
+    int len = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+    if (!jsink_write(em->sink, spaces, len)) return 0;
+  }
+  return 1;
+}
+
+/* Whatever goes before member `index` of a container, `depth` being the
+ * member's own depth. */
+static int jemit_member(jemitter_t* em, int index, int depth) {
+  if (em->flags & JWRITE_PRETTY)
+    return (!index || jsink_write(em->sink, ",", 1)) &&
+           jemit_newline(em, depth);
+  if (!index) return 1;
+  if (em->flags & JWRITE_COMPACT) return jsink_write(em->sink, ",", 1);
+  return jsink_write(em->sink, ", ", 2);
+}
+
+static int jemit_key(jemitter_t* em, const char* key, size_t len) {
+  if (!jemit_string(em, key, len)) return 0;
+  if ((em->flags & (JWRITE_COMPACT | JWRITE_PRETTY)) == JWRITE_COMPACT)
+    return jsink_write(em->sink, ":", 1);
+  return jsink_write(em->sink, ": ", 2);
+}
+
+/* Close a container whose members were at `depth` + 1. */
+static int jemit_close(jemitter_t* em, char close, int depth, int empty) {
+  if ((em->flags & JWRITE_PRETTY) && !empty && !jemit_newline(em, depth))
+    return 0;
+  return jsink_write(em->sink, &close, 1);
+}
+
+static int jnumber_to_string(jnode_t* jnode, jemitter_t* em) {
+  check_type(jnode, number, 0);
+  return jemit_number(em, jas_number(jnode)->value);
+}
+
+static int jstring_to_string(jnode_t* jnode, jemitter_t* em) {
+  check_type(jnode, string, 0);
+  jstring_t* jstring = jas_string(jnode);
+  return jemit_string(em, jvector_data(jstring->string),
+                      jvector_len(jstring->string));
+}
+
+static int jemit_cached(jemitter_t* em, jnode_t* jnode, jcache_t* cache);
+
+static int jto_string_pre(const jvisit_t* visit, void* ctx) {
+  jemitter_t* em = ctx;
+  if (visit->depth &&
+      !jemit_member(em, visit->index, em->base + visit->depth))
+    return 0;
+  if (visit->key && !jemit_key(em, visit->key, strlen(visit->key))) return 0;
+
+  jnode_t* jnode = visit->node;
+  if (jnode == em->hole) {
+    // only bounded sinks know the offset
+    int array = jis_array(jnode);
+    if (!jsink_write(em->sink, array ? "[" : "{", 1)) return 0;
+    em->at = em->sink->len + em->sink->to.dropped;
+    return jemit_close(em, array ? ']' : '}', em->base + visit->depth, 0)
+               ? JWALK_SKIP
+               : JWALK_ABORT;
+  }
+  if (jis_linked(jnode)) {
+    jcache_t* cache = jcache_of(jnode);
+    if (cache && jnode != em->fill && !(em->flags & JWRITE_PRETTY))
+      return jemit_cached(em, jnode, cache) ? JWALK_SKIP : JWALK_ABORT;
+    // plain serialization leaves the tree untouched for concurrent readers
+    if (em->fill && !cache) jas_linked(jnode)->flags &= ~JNODE_DIRTY;
+  }
+  switch (jtype(jnode)) {
+    case JARRAY: return jsink_write(em->sink, "[", 1);
+    case JOBJECT: return jsink_write(em->sink, "{", 1);
+    default: return jto_strings[jtype(jnode)](jnode, em);
+  }
+}
+
+static int jto_string_post(const jvisit_t* visit, void* ctx) {
+  jemitter_t* em = ctx;
+  jnode_t* jnode = visit->node;
+  switch (jtype(jnode)) {
+    case JARRAY: {
+      return jemit_close(em, ']', em->base + visit->depth,
+                         !jvector_len(jas_array(jnode)->array));
+    }
+    case JOBJECT: {
+      return jemit_close(em, '}', em->base + visit->depth,
+                         !jht_size(jas_object(jnode)->hashmap));
+    }
+    default: return 1;
+  }
+}
+
+#define jemit_tree(em, jnode)                              \
+  jwalk_ex((jnode), jto_string_pre, jto_string_post, (em), \
+           (em)->flags & JWRITE_SORT_KEYS)
+
+/* Copy the cached output of a container, rebuilding it first when the
+ * container changed or the layout differs. Rebuilding measures, sizes the
+ * cache once and writes, refreshing stale caches nested inside. */
+static int jemit_cached(jemitter_t* em, jnode_t* jnode, jcache_t* cache) {
+  int flags = em->flags & (JWRITE_COMPACT | JWRITE_SORT_KEYS);
+  tv* bytes = jas_tv(&cache->bytes);
+  if ((jas_linked(jnode)->flags & JNODE_DIRTY) || cache->flags != flags) {
+    jsink_t sink;
+    jsink_init_bounded(&sink, 0, 0);
+    jemitter_t sub = {.sink = &sink, .flags = flags, .fill = jnode};
+    if (!jemit_tree(&sub, jnode)) return 0;
+
+    int size = sink.to.dropped;
+    if (size > bytes->capacity) {
+      char* data = reallocate(bytes->data, bytes->capacity, size);
+      if (!data) return 0;
+      bytes->data = data;
+      bytes->capacity = size;
+    }
+    jsink_init_bounded(&sink, bytes->data, size);
+    cache->flags = -1;
+    if (!jemit_tree(&sub, jnode)) return 0;
+    bytes->len = size;
+    cache->flags = flags;
+    jas_linked(jnode)->flags &= ~JNODE_DIRTY;
+  }
+  return jsink_write(em->sink, bytes->data, bytes->len);
+}
+
+/* Measure first, then allocate once and write the exact size, so the
+ * output is never reallocated or copied. */
+char* jto_string_opts(jnode_t* jnode, const jwrite_opts_t* opts) {
+  jerror_clear();
+  jvector(char, numbers);
+  jvector_init(char, &numbers);
+  jsink_t sink;  // its own buffer stays unused and uninitialized
+  jsink_init_bounded(&sink, 0, 0);
+  jemitter_t em;
+  jemitter_init(&em, &sink, opts);
+  em.numbers = jas_tv(&numbers);
+
+  char* str = 0;
+  if (jemit_tree(&em, jnode)) {
+    size_t size = sink.to.dropped;
+    str = reallocate(0, 0, size + 1);
+    if (str) {
+      jsink_init_bounded(&sink, str, size);
+      em.replay = 1;
+      if (jemit_tree(&em, jnode)) {
+        str[size] = '\0';
+      } else {
+        str = reallocate(str, size + 1, 0);
+      }
+    }
+  }
+  jvector_free(char, &numbers);
+  return str;
+}
+
+char* jto_string(jnode_t* jnode) { return jto_string_opts(jnode, 0); }
+
+size_t jto_buffer_opts(jnode_t* jnode, char* buf, size_t cap,
+                       const jwrite_opts_t* opts) {
+  jerror_clear();
+  jsink_t sink;
+  jsink_init_bounded(&sink, buf, cap ? cap - 1 : 0);
+  jemitter_t em;
+  jemitter_init(&em, &sink, opts);
+  if (!jemit_tree(&em, jnode)) return 0;
+  if (cap) buf[sink.len] = '\0';
+  return sink.len + sink.to.dropped;
+}
+
+size_t jto_buffer(jnode_t* jnode, char* buf, size_t cap) {
+  return jto_buffer_opts(jnode, buf, cap, 0);
+}
+
+int jwrite_opts(jnode_t* jnode, jsink_t* sink, const jwrite_opts_t* opts) {
+  jerror_clear();
+  jemitter_t em;
+  jemitter_init(&em, sink, opts);
+  return jemit_tree(&em, jnode) && jsink_drain(sink);
+}
+
+int jwrite(jnode_t* jnode, jsink_t* sink) {
+  return jwrite_opts(jnode, sink, 0);
+}
+
+enum jwriter_state {
+  JWRITER_FIRST = 0,  // nothing written in the current container yet
+  JWRITER_NEXT,       // a member was written, the next needs a comma
+  JWRITER_VALUE,      // a key was written, its value is due
+  JWRITER_DONE,       // the top-level value is complete
+  JWRITER_FAILED,
+};
+
+#define jwriter_emitter(writer)                                    \
+  ((jemitter_t){.sink = (writer)->sink,                            \
+                .flags = (writer)->flags,                          \
+                .indent = (writer)->indent,                        \
+                .base = (writer)->depth})
+
+static int jwriter_in_object(const jwriter_t* writer) {
+  int level = writer->depth - 1;
+  return level >= 0 && writer->objects[level / 8] >> level % 8 & 1;
+}
+
+static int jwriter_fail(jwriter_t* writer, const char* what) {
+  if (writer->state == JWRITER_FAILED)
+    jerror_log(JERR_SYNTAX, "Writer failed on an earlier call.");
+  else jerror_log(JERR_SYNTAX, "Writer expects %s.", what);
+  writer->state = JWRITER_FAILED;
+  return 0;
+}
+
+/* The sink has already logged why. */
+static int jwriter_broken(jwriter_t* writer) {
+  writer->state = JWRITER_FAILED;
+  return 0;
+}
+
+/* Check that a value may start here and write the comma before it. */
+static int jwriter_value_start(jwriter_t* writer, jemitter_t* em) {
+  switch (writer->state) {
+    case JWRITER_FIRST:
+    case JWRITER_NEXT: {
+      if (jwriter_in_object(writer)) return jwriter_fail(writer, "a key");
+      if (!writer->depth) return 1;
+      return jemit_member(em, writer->state == JWRITER_NEXT, writer->depth) ||
+             jwriter_broken(writer);
+    }
+    case JWRITER_VALUE: return 1;
+    case JWRITER_DONE: return jwriter_fail(writer, "no more values");
+    default: return jwriter_fail(writer, 0);
+  }
+}
+
+static int jwriter_value_end(jwriter_t* writer, int ok) {
+  if (!ok) return jwriter_broken(writer);
+  writer->state = writer->depth ? JWRITER_NEXT : JWRITER_DONE;
+  return 1;
+}
+
+static int jwriter_begin(jwriter_t* writer, int object) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  if (writer->depth >= SJSON_MAX_DEPTH)
+    return jwriter_fail(writer, "less than SJSON_MAX_DEPTH levels");
+  if (!jsink_write(writer->sink, object ? "{" : "[", 1))
+    return jwriter_broken(writer);
+
+  unsigned char bit = 1 << writer->depth % 8;
+  if (object) writer->objects[writer->depth / 8] |= bit;
+  else writer->objects[writer->depth / 8] &= ~bit;
+  writer->depth++;
+  writer->state = JWRITER_FIRST;
+  return 1;
+}
+
+static int jwriter_end(jwriter_t* writer, int object) {
+  jerror_clear();
+  if (writer->state == JWRITER_FAILED) return jwriter_fail(writer, 0);
+  if (!writer->depth) return jwriter_fail(writer, "an open container");
+  if (writer->state == JWRITER_VALUE) return jwriter_fail(writer, "a value");
+  if (jwriter_in_object(writer) != object)
+    return jwriter_fail(writer, object ? "a value or ']'" : "a key or '}'");
+  jemitter_t em = jwriter_emitter(writer);
+  int empty = writer->state == JWRITER_FIRST;
+  writer->depth--;
+  return jwriter_value_end(
+      writer, jemit_close(&em, object ? '}' : ']', writer->depth, empty));
+}
+
+void jwriter_init_opts(jwriter_t* writer, jsink_t* sink,
+                       const jwrite_opts_t* opts) {
+  jemitter_t em;
+  jemitter_init(&em, sink, opts);
+  writer->sink = sink;
+  writer->flags = em.flags;
+  writer->indent = em.indent;
+  writer->depth = 0;
+  writer->state = JWRITER_FIRST;
+}
+
+void jwriter_init(jwriter_t* writer, jsink_t* sink) {
+  jwriter_init_opts(writer, sink, 0);
+}
+
+int jwriter_begin_object(jwriter_t* writer) { return jwriter_begin(writer, 1); }
+
+int jwriter_end_object(jwriter_t* writer) { return jwriter_end(writer, 1); }
+
+int jwriter_begin_array(jwriter_t* writer) { return jwriter_begin(writer, 0); }
+
+int jwriter_end_array(jwriter_t* writer) { return jwriter_end(writer, 0); }
+
+int jwriter_key(jwriter_t* writer, const char* key, int len) {
+  jerror_clear();
+  if (writer->state == JWRITER_FAILED) return jwriter_fail(writer, 0);
+  if (!jwriter_in_object(writer) || writer->state == JWRITER_VALUE)
+    return jwriter_fail(writer, "a value");
+  jemitter_t em = jwriter_emitter(writer);
+  if (!len) len = strlen(key);
+  if (!jemit_member(&em, writer->state == JWRITER_NEXT, writer->depth) ||
+      !jemit_key(&em, key, len))
+    return jwriter_broken(writer);
+  writer->state = JWRITER_VALUE;
+  return 1;
+}
+
+int jwriter_value_null(jwriter_t* writer) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  return jwriter_value_end(writer, jsink_write(em.sink, "null", 4));
+}
+
+int jwriter_value_bool(jwriter_t* writer, int value) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  return jwriter_value_end(writer, value ? jsink_write(em.sink, "true", 4)
+                                         : jsink_write(em.sink, "false", 5));
+}
+
+int jwriter_value_number(jwriter_t* writer, double value) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  return jwriter_value_end(writer, jemit_number(&em, value));
+}
+
+int jwriter_value_string(jwriter_t* writer, const char* string, int len) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  if (!len) len = strlen(string);
+  return jwriter_value_end(writer, jemit_string(&em, string, len));
+}
+
+int jwriter_value_node(jwriter_t* writer, jnode_t* jnode) {
+  jerror_clear();
+  jemitter_t em = jwriter_emitter(writer);
+  if (!jwriter_value_start(writer, &em)) return 0;
+  return jwriter_value_end(
+      writer, jemit_tree(&em, jnode));
+}
+
+int jwriter_finish(jwriter_t* writer) {
+  jerror_clear();
+  if (writer->state == JWRITER_FAILED) return jwriter_fail(writer, 0);
+  if (writer->state != JWRITER_DONE)
+    return jwriter_fail(writer, "a complete value before finishing");
+  return jsink_drain(writer->sink) || jwriter_broken(writer);
+}
+
+/* ==============================
+ *       2. NODE OPERATION
+ * ============================== */
+
+jnode_t* jnull_new() {
+  jerror_clear();
+  static jnull_t jnull_ = {.type = JNULL};
+  return jcast(&jnull_, jnode_t*);
+}
+
+jnode_t* jbool_new(int value) {
+  jerror_clear();
+  static jbool_t jtrue_ = {.type = JBOOLEAN, .value = 1};
+  static jbool_t jfalse_ = {.type = JBOOLEAN, .value = 0};
+  if (value) {
+    return jcast(&jtrue_, jnode_t*);
+  } else {
+    return jcast(&jfalse_, jnode_t*);
+  }
+}
+
+jnode_t* jnumber_new(double value) {
+  jerror_clear();
+  jnumber_t* jnum = reallocate(0, 0, sizeof(jnumber_t));
+  if (!jnum) return 0;
+  *jnum = (jnumber_t){.type = JNUMBER, .value = value};
+  return jcast(jnum, jnode_t*);
+}
+
+/* Strings keep a null terminator past their length, so the content is a C
+ * string. Mutations make room for it first and write it last. */
+#define jstring_room(jstr, len) jvector_grow(char, &(jstr)->string, (len) + 1)
+#define jstring_seal(jstr) \
+  (jvector_data((jstr)->string)[jvector_len((jstr)->string)] = '\0')
+
+jnode_t* jstring_new(int len, const char* string) {
+  jerror_clear();
+  jstring_t* jstr = reallocate(0, 0, sizeof(jstring_t));
+  if (!jstr) return 0;
+  *jstr = (jstring_t){.type = JSTRING};
+  jvector_init(char, &jstr->string);
+  if (!len) len = strlen(string);
+  if (!jvector_reserve(char, &jstr->string, len + 1)) {
+    reallocate(jstr, sizeof(jstring_t), 0);
+    return 0;
+  }
+  jvector_concat(char, &jstr->string, string, len);
+  jstring_seal(jstr);
+  return jcast(jstr, jnode_t*);
+}
+
+jnode_t* jarray_new() {
+  jerror_clear();
+  jarray_t* jarray = reallocate(0, 0, sizeof(jarray_t));
+  if (!jarray) return 0;
+  *jarray = (jarray_t){.type = JARRAY};
+  jvector_init(jnode_t, &jarray->array);
+  return jcast(jarray, jnode_t*);
+}
+
+static jnode_t* jobject_alloc(int capacity) {
+  jobject_t* jobj = reallocate(0, 0, sizeof(jobject_t));
+  if (!jobj) return 0;
+  *jobj = (jobject_t){.type = JOBJECT};
+  if (!jht_init(jas_tv(&jobj->hashmap), capacity)) {
+    reallocate(jobj, sizeof(jobject_t), 0);
+    return 0;
+  }
+  return jcast(jobj, jnode_t*);
+}
+
+jnode_t* jobject_new() {
+  jerror_clear();
+  return jobject_alloc(jht_capacity_grow(0));
+}
+
+/* Children are released before their container, so `kv` entries and array
+ * storage stay readable while the traversal moves on. */
+static int jdelete_post(const jvisit_t* visit, void* ctx) {
+  (void)ctx;
+  jnode_t* jnode = visit->node;
+  switch (jnode->type) {
+    case JNULL: break;
+    case JBOOLEAN: break;
+    case JNUMBER: reallocate(jnode, sizeof(jnumber_t), 0); break;
+    case JSTRING: {
+      jstring_t* jstr = jas_string(jnode);
+      jvector_free(char, &jstr->string);
+      reallocate(jstr, sizeof(jstring_t), 0);
+      break;
+    }
+    case JARRAY: {
+      jarray_t* jarray = jas_array(jnode);
+      jcache_free(jarray->cache);
+      jvector_free(jnode_t, &jarray->array);
+      reallocate(jarray, sizeof(jarray_t), 0);
+      break;
+    }
+    case JOBJECT: {
+      jobject_t* jobj = jas_object(jnode);
+      jcache_free(jobj->cache);
+      jht_free(jas_tv(&jobj->hashmap));
+      reallocate(jobj, sizeof(jobject_t), 0);
+      break;
+    }
+  }
+  return 1;
+}
+
+void jdelete(jnode_t* jnode) {
+  jerror_clear();
+  if (!jnode) return;
+  jwalk(jnode, 0, jdelete_post, 0);
+}
+
+/* Copies of the containers on the current path, indexed by depth. */
+static int jclone_pre(const jvisit_t* visit, void* ctx) {
+  tv* copies = ctx;
+  jnode_t* jnode = visit->node;
+  jnode_t* copy = 0;
+  switch (jnode->type) {
+    case JNULL:
+    case JBOOLEAN: copy = jnode; break;  // singletons
+    case JNUMBER: copy = jnumber_new(jas_number(jnode)->value); break;
+    case JSTRING: {
+      jstring_t* jstr = jas_string(jnode);
+      copy = jstring_new(jvector_len(jstr->string), jvector_data(jstr->string));
+      break;
+    }
+    case JARRAY: copy = jarray_new(); break;
+    case JOBJECT: copy = jobject_new(); break;
+  }
+  if (!copy) return JWALK_ABORT;
+
+  copies->len = visit->depth;
+  if (visit->parent) {
+    jnode_t* parent = jcast(copies->data, jnode_t**)[visit->depth - 1];
+    int ok = visit->key ? jobject_put(parent, visit->key, copy)
+                        : jarray_add(parent, copy);
+    if (!ok) {
+      jerror_keep(jdelete(copy));
+      return JWALK_ABORT;
+    }
+  }
+  if (!jvector_concat(jnode_t*, copies, &copy, 1)) {
+    if (!visit->parent) jerror_keep(jdelete(copy));
+    return JWALK_ABORT;
+  }
+  return JWALK_CONTINUE;
+}
+
+jnode_t* jclone(jnode_t* jnode) {
+  jerror_clear();
+  jvector(jnode_t*, copies);
+  jvector_init(jnode_t*, &copies);
+  int ok = jwalk(jnode, jclone_pre, 0, &copies);
+  jnode_t* copy = jvector_len(copies) ? *jvector_get(copies, 0) : 0;
+  if (!ok) jerror_keep(jdelete(copy));
+  jvector_free(jnode_t*, &copies);
+  return ok ? copy : 0;
+}
+
+int jnumber_set(jnode_t* jnode, double value) {
+  jerror_clear();
+  check_type(jnode, number, 0);
+  jas_number(jnode)->value = value;
+  jnode_touch(jnode);
+  return 1;
+}
+
+int jnode_cache(jnode_t* jnode, int enable) {
+  jerror_clear();
+  struct jcache** cache;
+  if (jis_array(jnode)) {
+    cache = &jas_array(jnode)->cache;
+  } else if (jis_object(jnode)) {
+    cache = &jas_object(jnode)->cache;
+  } else {
+    jerror_log(JERR_TYPE, "Expect type 'array' or 'object' but got type '%s'",
+               type_str[jtype(jnode)]);
+    return 0;
+  }
+
+  if (!enable) {
+    jcache_free(*cache);
+    *cache = 0;
+    return 1;
+  }
+  if (*cache) return 1;
+  jcache_t* new = reallocate(0, 0, sizeof(jcache_t));
+  if (!new) return 0;
+  new->flags = -1;
+  jvector_init(char, &new->bytes);
+  new->hash = 0;
+  *cache = new;
+  jnode_touch(jnode);  // descendants may be dirty already
+  return 1;
+}
+
+/* Structural hashes are 64-bit. Every type starts from its own seed, so
+ * that "" and [] differ, and each member is mixed before it is folded into
+ * its container. */
+#define JHASH_K 0x9e3779b97f4a7c15ull
+#define jhash_seed(type) (JHASH_K * ((type) + 1))
+#define jhash_kept(node) \
+  (jcache_of(node) && (jas_linked(node)->flags & JNODE_HASHED))
+
+static uint64_t jhash_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  return x ^ x >> 33;
+}
+
+static uint64_t jhash_bytes(const char* p, size_t len, uint64_t seed) {
+  uint64_t h = seed ^ len * JHASH_K;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    h = (h ^ jhash_mix(word)) * JHASH_K;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, p, len);
+  return jhash_mix(h ^ tail);
+}
+
+typedef struct jhash_ctx {
+  jvector(uint64_t, acc);  // partial hash of each open container, by depth
+  uint64_t hash;           // of the root
+  int keep;  // depth of the outermost container keeping hashes, -1 if none
+} jhash_ctx_t;
+
+/* Fold the hash of a member into its container: in order for arrays, as a
+ * sum for objects so that member order does not matter. */
+static void jhash_fold(jhash_ctx_t* ctx, const jvisit_t* visit, uint64_t h) {
+  if (!visit->parent) {
+    ctx->hash = h;
+    return;
+  }
+  uint64_t* acc = jvector_get(ctx->acc, visit->depth - 1);
+  if (visit->key) {
+    uint64_t key = jhash_bytes(visit->key, strlen(visit->key), JHASH_K);
+    *acc += jhash_mix(key * JHASH_K + h);
+  } else {
+    *acc = (*acc ^ h) * JHASH_K;
+  }
+}
+
+static int jhash_pre(const jvisit_t* visit, void* ctx) {
+  jhash_ctx_t* hc = ctx;
+  jnode_t* jnode = visit->node;
+  if (!jis_array(jnode) && !jis_object(jnode)) return JWALK_CONTINUE;
+  if (jhash_kept(jnode)) {
+    jhash_fold(hc, visit, jcache_of(jnode)->hash);
+    return JWALK_SKIP;
+  }
+  if (jcache_of(jnode) && hc->keep < 0) hc->keep = visit->depth;
+  uint64_t seed = jhash_seed(jtype(jnode));
+  hc->acc.len = visit->depth;
+  if (!jvector_concat(uint64_t, &hc->acc, &seed, 1)) return JWALK_ABORT;
+  return JWALK_CONTINUE;
+}
+
+static int jhash_post(const jvisit_t* visit, void* ctx) {
+  jhash_ctx_t* hc = ctx;
+  jnode_t* jnode = visit->node;
+  uint64_t seed = jhash_seed(jtype(jnode));
+  uint64_t h = seed;
+  switch (jtype(jnode)) {
+    case JNULL: break;
+    case JBOOLEAN: h = jhash_mix(seed + jas_bool(jnode)->value); break;
+    case JNUMBER: {
+      double value = jas_number(jnode)->value;
+      if (value == 0) value = 0;  // -0 equals 0
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      h = jhash_mix(seed ^ bits);
+      break;
+    }
+    case JSTRING: {
+      jstring_t* jstr = jas_string(jnode);
+      h = jhash_bytes(jvector_data(jstr->string), jvector_len(jstr->string),
+                      seed);
+      break;
+    }
+    case JARRAY: {
+      int len = jvector_len(jas_array(jnode)->array);
+      h = jhash_mix(*jvector_get(hc->acc, visit->depth) ^ len);
+      break;
+    }
+    case JOBJECT: {
+      int size = jht_size(jas_object(jnode)->hashmap);
+      h = jhash_mix(*jvector_get(hc->acc, visit->depth) ^ size);
+      break;
+    }
+  }
+
+  // below a cache every node is marked, so changes anywhere reach it
+  if (hc->keep >= 0 && jis_linked(jnode)) {
+    jas_linked(jnode)->flags |= JNODE_HASHED;
+    if (jcache_of(jnode)) jcache_of(jnode)->hash = h;
+    if (hc->keep == visit->depth) hc->keep = -1;
+  }
+  jhash_fold(hc, visit, h);
+  return 1;
+}
+
+uint64_t jhash(jnode_t* jnode) {
+  jerror_clear();
+  jhash_ctx_t ctx = {.keep = -1};
+  jvector_init(uint64_t, &ctx.acc);
+  int ok = jwalk_ex(jnode, jhash_pre, jhash_post, &ctx, 0);
+  jvector_free(uint64_t, &ctx.acc);
+  return ok ? ctx.hash : 0;
+}
+
+/* Compare all but the members of containers. Kept hashes which differ
+ * prove containers unequal without looking inside. */
+static int jequal_node(jnode_t* a, jnode_t* b) {
+  if (!b || jtype(a) != jtype(b)) return 0;
+  if (a == b) return 1;
+  switch (jtype(a)) {
+    case JNULL: return 1;
+    case JBOOLEAN: return jas_bool(a)->value == jas_bool(b)->value;
+    case JNUMBER: return jas_number(a)->value == jas_number(b)->value;
+    case JSTRING: {
+      jstring_t* x = jas_string(a);
+      jstring_t* y = jas_string(b);
+      int len = jvector_len(x->string);
+      return len == jvector_len(y->string) &&
+             (!len ||
+              !memcmp(jvector_data(x->string), jvector_data(y->string), len));
+    }
+    case JARRAY: {
+      if (jvector_len(jas_array(a)->array) != jvector_len(jas_array(b)->array))
+        return 0;
+      break;
+    }
+    case JOBJECT: {
+      if (jht_size(jas_object(a)->hashmap) !=
+          jht_size(jas_object(b)->hashmap))
+        return 0;
+      break;
+    }
+  }
+  return !jhash_kept(a) || !jhash_kept(b) ||
+         jcache_of(a)->hash == jcache_of(b)->hash;
+}
+
+typedef struct jequal_ctx {
+  jnode_t* other;             // root of the other tree
+  jvector(jnode_t*, opened);  // counterparts of the open containers
+  int equal;
+} jequal_ctx_t;
+
+static jkv_t* jobject_find(jobject_t* jobj, const char* key,
+                           unsigned int hash);
+
+/* Walk one tree and find each node's counterpart in the other. */
+static int jequal_pre(const jvisit_t* visit, void* ctx) {
+  jequal_ctx_t* ec = ctx;
+  jnode_t* a = visit->node;
+  jnode_t* b = ec->other;
+  if (visit->parent) {
+    jnode_t* parent = *jvector_get(ec->opened, visit->depth - 1);
+    if (visit->key) {
+      jkv_t* kv = jobject_find(jas_object(parent), visit->key,
+                               fnv1a(visit->key));
+      b = kv ? kv->value : 0;
+    } else {
+      b = *jvector_get(jas_array(parent)->array, visit->index);
+    }
+  }
+  if (!jequal_node(a, b)) {
+    ec->equal = 0;
+    return JWALK_ABORT;
+  }
+  if (a == b || (!jis_array(a) && !jis_object(a))) return JWALK_SKIP;
+  ec->opened.len = visit->depth;
+  if (!jvector_concat(jnode_t*, &ec->opened, &b, 1)) return JWALK_ABORT;
+  return JWALK_CONTINUE;
+}
+
+int jequal(jnode_t* a, jnode_t* b) {
+  jerror_clear();
+  jequal_ctx_t ctx = {.other = b, .equal = 1};
+  jvector_init(jnode_t*, &ctx.opened);
+  int ok = jwalk_ex(a, jequal_pre, 0, &ctx, 0);
+  jvector_free(jnode_t*, &ctx.opened);
+  return ok && ctx.equal;
+}
+
+/* ==============================
+ *      3. STRING OPERATION
+ * ============================== */
+
+int jstring_len(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  return jvector_len(jstr->string);
+}
+
+char jstring_get(jnode_t* jnode, int index) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  return *jvector_get(jstr->string, index);
+}
+
+const char* jstring_content(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  return jvector_data(jstr->string);
+}
+
+int jstring_add(jnode_t* jnode, char c) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  if (!jstring_room(jstr, jvector_len(jstr->string) + 1)) return 0;
+  jnode_touch(jnode);
+  jvector_concat(char, &jstr->string, &c, 1);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_insert(jnode_t* jnode, int index, char c) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  if (!jstring_room(jstr, jvector_len(jstr->string) + 1) ||
+      !jvector_insert(char, &jstr->string, index, &c, 1))
+    return 0;
+  jnode_touch(jnode);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_concat(jnode_t* jnode, const char* string) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  return jstring_append_n(jnode, string, strlen(string));
+}
+
+int jstring_pop(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  jnode_touch(jnode);
+  jvector_pop(char, &jstr->string, 1);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_remove(jnode_t* jnode, int index) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  if (!jvector_remove(char, &jstr->string, index, 1)) return 0;
+  jnode_touch(jnode);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_truncate(jnode_t* jnode, int len) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  jnode_touch(jnode);
+  if (len < jvector_len(jstr->string))
+    jvector_pop(char, &jstr->string, jvector_len(jstr->string) - len);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_splice(jnode_t* jnode, int index, int remove, const char* string,
+                   int insert) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  if (insert > 0 && !string) {
+    jerror_log(JERR_ARG, "Null string.");
+    return 0;
+  }
+  jstring_t* jstr = jas_string(jnode);
+  tv* v = jas_tv(&jstr->string);
+  if (!tvector_check_splice(v, index, remove, insert) ||
+      !jstring_room(jstr, v->len - remove + insert))
+    return 0;
+  jvector_splice(char, &jstr->string, index, remove, string, insert);
+  jnode_touch(jnode);
+  jstring_seal(jstr);
+  return 1;
+}
+
+int jstring_append_n(jnode_t* jnode, const char* string, int len) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  if (len < 0) {
+    jerror_log(JERR_ARG, "Invalid length '%d'.", len);
+    return 0;
+  }
+  if (!jstring_room(jstr, jvector_len(jstr->string) + len)) return 0;
+  jvector_concat(char, &jstr->string, string, len);
+  jnode_touch(jnode);
+  jstring_seal(jstr);
+  return 1;
+}
+
+/* Room for `capacity` bytes in all, not counting the terminator. */
+int jstring_reserve(jnode_t* jnode, int capacity) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  return jvector_reserve(char, &jas_string(jnode)->string, capacity + 1);
+}
+
+int jstring_shrink_to_fit(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, string, 0);
+  jstring_t* jstr = jas_string(jnode);
+  return jvector_shrink(char, &jstr->string, jvector_len(jstr->string) + 1);
+}
+
+/* ==============================
+ *       4. ARRAY OPERATION
+ * ============================== */
+
+int jarray_size(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  return jvector_len(jarr->array);
+}
+
+jnode_t* jarray_get(jnode_t* jnode, int index) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  return *jvector_get(jarr->array, index);
+}
+
+int jarray_add(jnode_t* jnode, jnode_t* value) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  if (!jvector_concat(jnode_t*, &jarr->array, &value, 1)) return 0;
+  jnode_adopt(jnode, value);
+  return 1;
+}
+
+int jarray_insert(jnode_t* jnode, int index, jnode_t* value) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  if (!jvector_insert(jnode_t*, &jarr->array, index, &value, 1)) return 0;
+  jnode_adopt(jnode, value);
+  return 1;
+}
+
+int jarray_pop(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  jnode_t* item = *jvector_pop(jnode_t*, &jarr->array, 1);
+  if (item) {
+    jnode_touch(jnode);
+    jdelete(item);
+    return 1;
+  } else {
+    jerror_log(JERR_INDEX, "Array is empty.");
+    return 0;
+  }
+}
+
+int jarray_remove(jnode_t* jnode, int index) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  int valid = index >= 0 && index < jvector_len(jarr->array);
+  jnode_t* item = valid ? *jvector_get(jarr->array, index) : 0;
+  if (!jvector_remove(jnode_t*, &jarr->array, index, 1)) return 0;
+  jnode_touch(jnode);
+  jdelete(item);
+  return 1;
+}
+
+/* Grow first, so that a failure leaves the array and `items` untouched. */
+int jarray_splice(jnode_t* jnode, int index, int remove, jnode_t** items,
+                  int insert) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  if (insert > 0 && !items) {
+    jerror_log(JERR_ARG, "Null items.");
+    return 0;
+  }
+  jarray_t* jarr = jas_array(jnode);
+  int len = jvector_len(jarr->array);
+  if (!tvector_check_splice(jas_tv(&jarr->array), index, remove, insert) ||
+      !jvector_grow(jnode_t*, &jarr->array, len - remove + insert))
+    return 0;
+
+  for (int i = index; i < index + remove; i++)
+    jdelete(*jvector_get(jarr->array, i));
+  jvector_splice(jnode_t*, &jarr->array, index, remove, items, insert);
+  for (int i = 0; i < insert; i++) jnode_adopt(jnode, items[i]);
+  if (!insert) jnode_touch(jnode);  // only removed
+  return 1;
+}
+
+int jarray_extend(jnode_t* jnode, jnode_t** items, int len) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  return jarray_splice(jnode, jvector_len(jas_array(jnode)->array), 0, items,
+                       len);
+}
+
+int jarray_reserve(jnode_t* jnode, int capacity) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  return jvector_reserve(jnode_t*, &jas_array(jnode)->array, capacity);
+}
+
+int jarray_shrink_to_fit(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, array, 0);
+  jarray_t* jarr = jas_array(jnode);
+  return jvector_shrink(jnode_t*, &jarr->array, jvector_len(jarr->array));
+}
+
+void jarray_foreach(jnode_t* jnode, void (*f)(jnode_t*)) {
+  jerror_clear();
+  check_type(jnode, array, );
+  jarray_t* jarr = jas_array(jnode);
+  jvector_foreach(i, jarr->array) {
+    jnode_t* item = *jvector_get(jarr->array, i);
+    f(item);
+  }
+}
+
+void jarray_foreach_ctx(jnode_t* jnode, void (*f)(jnode_t*, void*),
+                        void* ctx) {
+  jerror_clear();
+  check_type(jnode, array, );
+  jarray_t* jarr = jas_array(jnode);
+  jvector_foreach(i, jarr->array) {
+    jnode_t* item = *jvector_get(jarr->array, i);
+    f(item, ctx);
+  }
+}
+
+/* ==============================
+ *      5. OBJECT OPERATION
+ * ============================== */
+
+/* Lookups never modify the table, so a tree without writers can be read
+ * from many threads at once. Rehashing happens in jobject_put() and
+ * jobject_compact() only. */
+
+int jobject_size(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, object, 0);
+  jobject_t* jobj = jas_object(jnode);
+  return jht_size(jobj->hashmap);
+}
+
+/* Entry of `key`, whose fnv1a() is `hash`, or 0. Callers that look the same
+ * key up many times hash it once. */
+static jkv_t* jobject_find(jobject_t* jobj, const char* key,
+                           unsigned int hash) {
+  jkv_t* head = jht_get(jobj->hashmap, hash % jht_capacity(jobj->hashmap));
+  for (jkv_t* it = head->next; it; it = it->next) {
+    if (!strcmp(key, it->key)) return it;
+  }
+  return 0;
+}
+
+int jobject_has(jnode_t* jnode, const char* key) {
+  jerror_clear();
+  check_type(jnode, object, 0);
+  return jobject_find(jas_object(jnode), key, fnv1a(key)) != 0;
+}
+
+jnode_t* jobject_get(jnode_t* jnode, const char* key) {
+  jerror_clear();
+  check_type(jnode, object, 0);
+  jkv_t* kv = jobject_find(jas_object(jnode), key, fnv1a(key));
+  if (kv) return kv->value;
+
+  jerror_log(JERR_KEY, "Key '%s' not exists.", key);
+  return 0;
+}
+
+void jkey_init(jkey_t* key, const char* string) {
+  key->key = string;
+  key->hash = fnv1a(string);
+}
+
+#define JOBJECT_PROBE_BATCH 8
+
+/* Look up a batch of keys in three passes: find every bucket, then every
+ * first entry, then walk the chains. Each pass prefetches what the next
+ * one reads, so the cache misses of the whole batch overlap instead of
+ * being paid one key at a time. Bit `bit + i` of `missing` is set for each
+ * key not found. */
+static int jobject_probe(jobject_t* jobj, const jkey_t* keys, int n,
+                         jnode_t** out, uint64_t* missing, int bit) {
+  jkv_t* heads[JOBJECT_PROBE_BATCH];
+  int capacity = jht_capacity(jobj->hashmap);
+  for (int i = 0; i < n; i++) {
+    heads[i] = jht_get(jobj->hashmap, keys[i].hash % capacity);
+    __builtin_prefetch(heads[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    heads[i] = heads[i]->next;
+    if (heads[i]) __builtin_prefetch(heads[i]);
+  }
+
+  int found = 0;
+  for (int i = 0; i < n; i++) {
+    jkv_t* it = heads[i];
+    while (it && strcmp(keys[i].key, it->key)) it = it->next;
+    out[i] = it ? it->value : 0;
+    if (it) found++;
+    else if (missing) missing[(bit + i) / 64] |= 1ull << (bit + i) % 64;
+  }
+  return found;
+}
+
+/* Shared checks of the jobject_get_many* functions. */
+static int jobject_get_many_init(jnode_t* jnode, int n, jnode_t** out,
+                                 uint64_t* missing) {
+  if (n < 0) {
+    jerror_log(JERR_ARG, "Negative key count %d.", n);
+    return 0;
+  }
+  if (missing) memset(missing, 0, (n + 63) / 64 * sizeof(uint64_t));
+  if (jis_object(jnode)) return 1;
+
+  jerror_log(JERR_TYPE, "Expect type 'object' but got type '%s'",
+             type_str[jtype(jnode)]);
+  memset(out, 0, n * sizeof(jnode_t*));
+  for (int i = 0; missing && i < n; i++) missing[i / 64] |= 1ull << i % 64;
+  return 0;
+}
+
+int jobject_get_many(jnode_t* jnode, const char* const* keys, int n,
+                     jnode_t** out, uint64_t* missing) {
+  jerror_clear();
+  if (!jobject_get_many_init(jnode, n, out, missing)) return 0;
+  jobject_t* jobj = jas_object(jnode);
+  int found = 0;
+  for (int base = 0; base < n; base += JOBJECT_PROBE_BATCH) {
+    jkey_t batch[JOBJECT_PROBE_BATCH];
+    int len = n - base < JOBJECT_PROBE_BATCH ? n - base : JOBJECT_PROBE_BATCH;
+    for (int i = 0; i < len; i++) jkey_init(batch + i, keys[base + i]);
+    found += jobject_probe(jobj, batch, len, out + base, missing, base);
+  }
+  return found;
+}
+
+int jobject_get_keys(jnode_t* jnode, const jkey_t* keys, int n,
+                     jnode_t** out, uint64_t* missing) {
+  jerror_clear();
+  if (!jobject_get_many_init(jnode, n, out, missing)) return 0;
+  jobject_t* jobj = jas_object(jnode);
+  int found = 0;
+  for (int base = 0; base < n; base += JOBJECT_PROBE_BATCH) {
+    int len = n - base < JOBJECT_PROBE_BATCH ? n - base : JOBJECT_PROBE_BATCH;
+    found += jobject_probe(jobj, keys + base, len, out + base, missing, base);
+  }
+  return found;
+}
+
+int jobject_put(jnode_t* jnode, const char* key, jnode_t* value) {
+  jerror_clear();
+  if (!key) {
+    jerror_log(JERR_ARG, "Null key.");
+    return 0;
+  }
+
+  check_type(jnode, object, 0);
+  jobject_t* jobj = jas_object(jnode);
+  int hash = fnv1a(key);
+  jkv_t* head = jht_head(jobj->hashmap, key);
+
+  int len = 0;
+  jkv_t *target = 0, *prev = head;
+  for (jkv_t* it = head->next; it; prev = it, it = it->next) {
+    len++;
+    if (!strcmp(key, it->key)) {
+      target = it;
+      break;
+    }
+  }
+
+  int changed = 0;
+  if (target) {
+    if (value) {
+      // update
+      jnode_t* old = target->value;
+      target->value = value;
+      jdelete(old);
+      jnode_adopt(jnode, value);
+      changed = 1;
+    } else {
+      // erase
+      prev->next = target->next;
+      jdelete(target->value);
+      reallocate(target->key, 0, 0);
+      reallocate(target, sizeof(jkv_t), 0);
+
+      jht_size(jobj->hashmap)--;
+      jnode_touch(jnode);
+      changed = 1;
+    }
+  } else {
+    if (value) {
+      // add
+      jkv_t* new = reallocate(0, 0, sizeof(jkv_t));
+      if (!new) return 0;
+      new->value = value;
+      int len = strlen(key);
+      new->key = reallocate(0, 0, len + 1);
+      if (!new->key) {
+        reallocate(new, sizeof(jkv_t), 0);
+        return 0;
+      }
+      strcpy(new->key, key);
+
+      // prepend
+      new->next = head->next;
+      head->next = new;
+
+      jht_size(jobj->hashmap)++;
+      jnode_adopt(jnode, value);
+      changed = 1;
+    } else {
+      // do nothing
+      jerror_log(JERR_ARG, "Null key and null value.");
+      changed = 0;
+    }
+  }
+
+  // remap if load is too high
+  if (len > jht_max_len) {
+    jht_grow(jas_tv(&jobj->hashmap));
+  }
+
+  return changed;
+}
+
+int jobject_compact(jnode_t* jnode) {
+  jerror_clear();
+  check_type(jnode, object, 0);
+  jobject_t* jobj = jas_object(jnode);
+  int capacity = jht_capacity_for(jht_size(jobj->hashmap));
+  if (capacity == jht_capacity(jobj->hashmap)) return 1;
+  jnode_touch(jnode);  // members come out in a new order
+  return jht_resize(jas_tv(&jobj->hashmap), capacity);
+}
+
+void jobject_foreach(jnode_t* jnode, void (*f)(const char*, jnode_t*)) {
+  jerror_clear();
+  check_type(jnode, object, );
+  jobject_t* jobj = jas_object(jnode);
+  for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
+    jkv_t* head = jht_get(jobj->hashmap, i);
+    for (jkv_t* it = head->next; it; it = it->next) {
+      f(it->key, it->value);
+    }
+  }
+}
+
+void jobject_foreach_ctx(jnode_t* jnode,
+                         void (*f)(const char*, jnode_t*, void*),
+                         void* ctx) {
+  jerror_clear();
+  check_type(jnode, object, );
+  jobject_t* jobj = jas_object(jnode);
+  for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
+    jkv_t* head = jht_get(jobj->hashmap, i);
+    for (jkv_t* it = head->next; it; it = it->next) {
+      f(it->key, it->value, ctx);
+    }
+  }
+}
+
+int jiter_init(jiter_t* it, jnode_t* jnode) {
+  jerror_clear();
+  *it = (jiter_t){.index = -1, .bucket = -1};
+  if (!jis_array(jnode) && !jis_object(jnode)) {
+    jerror_log(JERR_TYPE, "Expect type 'array' or 'object' but got type '%s'",
+               type_str[jtype(jnode)]);
+    return 0;
+  }
+  it->node = jnode;
+  return 1;
+}
+
+/* ==============================
+ *          6. FROM_STRING
+ * ============================== */
+
+/* ==============================
+ *          6.1 LEXING
+ * ============================== */
+
+/* Scanners below are shared by the lexer and jvalidate(). They only read
+ * [p, end) and never need the input to be null-terminated. */
+
+#define jis_blank(c) \
+  ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+#define jis_digit(c) ((unsigned)((c) - '0') < 10)
+#define jis_hex(c) \
+  (jis_digit(c) || (unsigned)(((c) | 0x20) - 'a') < 6)
+
+/* Length of the UTF-8 sequence at `p`, 0 when it is malformed. Overlong
+ * forms, surrogates and code points above U+10FFFF are rejected. */
+static int jutf8_len(const char* p, const char* end) {
+  const unsigned char* s = (const unsigned char*)p;
+  int rest = end - p;
+  unsigned char lo = 0x80, hi = 0xBF;
+  int len;
+  if (s[0] < 0x80) return 1;
+  else if (s[0] < 0xC2) return 0;
+  else if (s[0] < 0xE0) len = 2;
+  else if (s[0] < 0xF0) {
+    len = 3;
+    if (s[0] == 0xE0) lo = 0xA0;
+    if (s[0] == 0xED) hi = 0x9F;
+  } else if (s[0] < 0xF5) {
+    len = 4;
+    if (s[0] == 0xF0) lo = 0x90;
+    if (s[0] == 0xF4) hi = 0x8F;
+  } else return 0;
+
+  if (rest < len || s[1] < lo || s[1] > hi) return 0;
+  for (int i = 2; i < len; i++)
+    if ((s[i] & 0xC0) != 0x80) return 0;
+  return len;
+}
+
+/* Scan a number, return its end or 0 when malformed. */
+static const char* jscan_number(const char* p, const char* end) {
+  if (p < end && *p == '-') p++;
+  if (p >= end || !jis_digit(*p)) return 0;
+  if (*p == '0') p++;
+  else
+    while (p < end && jis_digit(*p)) p++;
+
+  if (p < end && *p == '.') {
+    if (++p >= end || !jis_digit(*p)) return 0;
+    while (p < end && jis_digit(*p)) p++;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    if (++p < end && (*p == '+' || *p == '-')) p++;
+    if (p >= end || !jis_digit(*p)) return 0;
+    while (p < end && jis_digit(*p)) p++;
+  }
+  return p;
+}
+
+/* Convert a scanned number. Short integers skip strtod, they are exact. */
+static double jnumber_parse(const char* p, int len) {
+  int neg = *p == '-';
+  if (len - neg <= 15) {
+    int64_t value = 0;
+    int i = neg;
+    while (i < len && jis_digit(p[i])) value = value * 10 + (p[i++] - '0');
+    if (i == len) return neg ? -(double)value : (double)value;
+  }
+
+  char buffer[64];
+  char* str = len < (int)sizeof(buffer) ? buffer : malloc(len + 1);
+  if (!str) return strtod(p, 0);
+  memcpy(str, p, len);
+  str[len] = 0;
+  double value = strtod(str, 0);
+  if (str != buffer) free(str);
+  return value;
+}
+
+/* Scan a string body starting after the opening quote. Return the closing
+ * quote, or 0 with `*bad` at the offending byte. */
+static const char* jscan_string(const char* p, const char* end, int utf8,
+                                const char** bad) {
+  for (;;) {
+    p = jspan_plain(p, end, utf8);
+    if (p >= end) break;
+
+    unsigned char c = *p;
+    if (c == '"') return p;
+    if (c == '\\') {
+      if (end - p < 2) break;
+      switch (p[1]) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't': p += 2; continue;
+        case 'u': {
+          if (end - p < 6 || !jis_hex(p[2]) || !jis_hex(p[3]) ||
+              !jis_hex(p[4]) || !jis_hex(p[5]))
+            break;
+          p += 6;
+          continue;
+        }
+      }
+      break;
+    }
+    if (c < 0x20) break;
+    if (c < 0x80 || !utf8) {
+      p++;
+      continue;
+    }
+    int len = jutf8_len(p, end);
+    if (!len) break;
+    p += len;
+  }
+  *bad = p;
+  return 0;
+}
+
+static const char* jscan_string_what(const char* bad, const char* end) {
+  if (bad >= end) return "Unterminated string";
+  if (*bad == '\\') return "Invalid escape sequence in string";
+  if ((unsigned char)*bad < 0x20) return "Invalid control character in string";
+  return "Invalid UTF-8 in string";
+}
+
+/* Line and column of `offset`, both 1-based. */
+static void jlinecol(const char* buf, size_t offset, int* line, int* col) {
+  const char* p = buf;
+  const char* end = buf + offset;
+  const char* start = buf;
+  *line = 1;
+  while ((p = memchr(p, '\n', end - p))) {
+    (*line)++;
+    start = ++p;
+  }
+  *col = end - start + 1;
+}
+
+#define jlinecol_str " at line %d, column %d."
+/* Only the byte offset is tracked while lexing. Line and column are computed
+ * on the failure path by rescanning the input up to the error. */
+#define jlexer_error(lexer, code, offset, fmt, ...)                   \
+  do {                                                                \
+    int line_, col_;                                                  \
+    size_t offset_ = (offset);                                        \
+    jlinecol((lexer)->data, offset_, &line_, &col_);                  \
+    jerror_log((code), fmt jlinecol_str, ##__VA_ARGS__, line_, col_); \
+    jerror_locate(offset_, line_, col_);                              \
+  } while (0)
+#define jlexer_ptr(lexer, index) ((lexer)->data + (index))
+#define jlexer_currptr(lexer) jlexer_ptr((lexer), (lexer)->curr)
+#define jlexer_look(lexer, offset) \
+  (*jlexer_ptr((lexer), (lexer)->curr + (offset)))
+#define jlexer_peek(lexer) jlexer_look((lexer), 0)
+#define jlexer_match(lexer, c) (jlexer_peek(lexer) == (c))
+#define jlexer_advance(lexer) ((lexer)->curr++)
+#define jlexer_move(lexer, distance) ((lexer)->curr += (distance))
+#define jlexer_rest(lexer) ((lexer)->len - (lexer)->curr)
+#define jlexer_is_end(lexer) ((lexer)->curr >= (lexer)->len)
+#define jlexer_to_token(lexer, tk, type_, len_, ...) \
+  *(tk) = (jtoken_t){.type = (type_),                \
+                     .len = (len_),                  \
+                     .lexeme = jlexer_currptr(lexer), \
+                     ##__VA_ARGS__}
+
+#define jtoken_offset(lexer, token) ((token)->lexeme - (lexer)->data)
+#define jtoken_lenlexeme(token) (token)->len, (token)->lexeme
+
+enum jtktype {
+  JTK_NULL = 256,
+  JTK_TRUE,
+  JTK_FALSE,
+  JTK_NUMBER,
+  JTK_STRING,
+  JTK_EOF,
+};
+
+typedef struct jtoken {
+  int type;
+  int len;
+  const char* lexeme;
+  union {
+    const char* string;
+  } as;
+} jtoken_t;
+
+typedef struct jlexer {
+  size_t len;
+  size_t curr;
+  int flags;  // JPARSE_* flags
+  const char* data;
+} jlexer_t;
+
+static void jlexer_skip_blank(jlexer_t* lexer) {
+  while (!jlexer_is_end(lexer) && jis_blank(jlexer_peek(lexer)))
+    jlexer_advance(lexer);
+}
+
+static int jlex_keyword(jlexer_t* lexer, jtoken_t* tk, int type,
+                        const char* keyword) {
+  int len = strlen(keyword);
+  if (jlexer_rest(lexer) < (size_t)len) {
+    jlexer_error(lexer, JERR_SYNTAX, lexer->curr,
+                 "Insufficient input for lexing");
+    return 0;
+  }
+  if (!strncmp(jlexer_currptr(lexer), keyword, len)) {
+    jlexer_to_token(lexer, tk, type, len);
+    jlexer_move(lexer, len);
+    return 1;
+  } else {
+    int rest = jlexer_rest(lexer) < 8 ? jlexer_rest(lexer) : 8;
+    jlexer_error(lexer, JERR_SYNTAX, lexer->curr,
+                 "Expect keyword '%s' but got '%.*s'", keyword, rest,
+                 jlexer_currptr(lexer));
+    return 0;
+  }
+}
+
+static int jlex_number(jlexer_t* lexer, jtoken_t* tk) {
+  const char* start = jlexer_currptr(lexer);
+  const char* end = jscan_number(start, jlexer_ptr(lexer, lexer->len));
+  if (!end) {
+    int rest = jlexer_rest(lexer) < 8 ? jlexer_rest(lexer) : 8;
+    jlexer_error(lexer, JERR_SYNTAX, lexer->curr,
+                 "Unknown number format '%.*s'", rest, start);
+    return 0;
+  }
+
+  // converted only when a node is made, skipped numbers never are
+  int len = end - start;
+  jlexer_to_token(lexer, tk, JTK_NUMBER, len);
+  jlexer_move(lexer, len);
+  return 1;
+}
+
+static int jlex_string(jlexer_t* lexer, jtoken_t* tk) {
+  if (!jlexer_match(lexer, '\"')) {
+    jlexer_error(lexer, JERR_SYNTAX, lexer->curr, "Expect \" but got '%c'",
+                 jlexer_peek(lexer));
+    return 0;
+  }
+  const char* body = jlexer_currptr(lexer) + 1;
+  const char* end = jlexer_ptr(lexer, lexer->len);
+  const char* bad = 0;
+  const char* close = jscan_string(body, end, lexer->flags & JPARSE_UTF8, &bad);
+  if (!close) {
+    int code = bad < end && (unsigned char)*bad >= 0x80 ? JERR_UTF8
+                                                        : JERR_SYNTAX;
+    jlexer_error(lexer, code, bad - lexer->data, "%s",
+                 jscan_string_what(bad, end));
+    return 0;
+  }
+
+  int len = close + 1 - jlexer_currptr(lexer);
+  jlexer_to_token(lexer, tk, JTK_STRING, len, .as.string = body);
+  jlexer_move(lexer, len);
+  return 1;
+}
+
+/* Lex the next token on demand, so no token buffer is ever built. */
+static int jlex(jlexer_t* lexer, jtoken_t* tk) {
+  jlexer_skip_blank(lexer);
+  if (jlexer_is_end(lexer)) {
+    jlexer_to_token(lexer, tk, JTK_EOF, 0);
+    return 1;
+  }
+
+  switch (jlexer_peek(lexer)) {
+    case 'n': return jlex_keyword(lexer, tk, JTK_NULL, "null");
+    case 't': return jlex_keyword(lexer, tk, JTK_TRUE, "true");
+    case 'f': return jlex_keyword(lexer, tk, JTK_FALSE, "false");
+
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+    case '-': return jlex_number(lexer, tk);
+
+    case '\"': return jlex_string(lexer, tk);
+
+    case '[':
+    case ']':
+    case '{':
+    case '}':
+    case ',':
+    case ':': {
+      jlexer_to_token(lexer, tk, jlexer_peek(lexer), 1);
+      jlexer_advance(lexer);
+      return 1;
+    }
+
+    default: {
+      // Unrecognizable character
+      jlexer_error(lexer, JERR_SYNTAX, lexer->curr,
+                   "Unrecognizable character '%c'", jlexer_peek(lexer));
+      return 0;
+    }
+  }
+}
+
+/* ==============================
+ *          6.2 PARSING
+ * ============================== */
+
+#define jparser_currptr(parser) (&(parser)->tk)
+#define jparser_match(parser, type_) (jparser_currptr(parser)->type == (type_))
+#define jparser_advance(parser) jlex(&(parser)->lexer, &(parser)->tk)
+#define jparser_is_end(parser) jparser_match((parser), JTK_EOF)
+#define jparser_projecting(parser) \
+  ((parser)->npaths &&             \
+   (!jvector_len((parser)->stack) || jparser_top(parser)->nlive))
+#define jparser_top(parser) \
+  (jvector_data((parser)->stack) + jvector_len((parser)->stack) - 1)
+#define jparser_expect(parser, what)                                       \
+  do {                                                                     \
+    const jtoken_t* tk_ = jparser_currptr(parser);                         \
+    jlexer_error(&(parser)->lexer, JERR_SYNTAX,                            \
+                 jtoken_offset(&(parser)->lexer, tk_),                     \
+                 "Expect " what " but got '%.*s'", jtoken_lenlexeme(tk_)); \
+  } while (0)
+
+/* An array or object which is still open. Its node is only made when it
+ * closes, at its final size, from the members gathered so far. */
+typedef struct jframe {
+  int object;
+  int first;        // first member in `members`
+  int keys;         // object only, first key byte in `keys`
+  int keylen;       // object only, length of the pending key
+  const char* key;  // object only, points into the input
+  int live;         // projection only, first path still to match in `live`
+  int nlive;        // projection only, 0 when the container is kept whole
+  int kept;         // projected array only, members up to the last kept one
+} jframe_t;
+
+/* A parsed member of an open container. */
+typedef struct jmember {
+  jnode_t* value;
+  int key;  // object only, offset of the unescaped key in `keys`
+} jmember_t;
+
+typedef struct jparser {
+  jlexer_t lexer;
+  jtoken_t tk;  // current token
+  int max_depth;
+  jvector(jframe_t, stack);
+  jvector(jmember_t, members);  // members of every open container, stacked
+  jvector(char, keys);          // their null-terminated keys
+  jvector(char, key);           // scratch buffer for unescaped strings
+  const jpath_t* const* paths;  // projection only, see jparser_project()
+  int npaths;
+  int npick;                    // paths matching the value being opened
+  jvector(int, live);           // paths matching each projected container
+} jparser_t;
+
+/* Parse [buf + begin, buf + end). Offsets stay relative to `buf`, so errors
+ * inside a slice still report their position in the whole input. */
+static void jparser_init(jparser_t* parser, const char* buf, size_t begin,
+                         size_t end, const jparse_opts_t* opts) {
+  *parser = (jparser_t){.lexer = {.len = end,
+                                  .curr = begin,
+                                  .flags = opts ? opts->flags : 0,
+                                  .data = buf},
+                        .max_depth = SJSON_MAX_DEPTH};
+  if (opts && opts->max_depth > 0) parser->max_depth = opts->max_depth;
+  jvector_init(jframe_t, &parser->stack);
+  jvector_init(jmember_t, &parser->members);
+  jvector_init(char, &parser->keys);
+  jvector_init(char, &parser->key);
+  jvector_init(int, &parser->live);
+}
+
+static void jparser_free(jparser_t* parser) {
+  jvector_free(jframe_t, &parser->stack);
+  jvector_free(jmember_t, &parser->members);
+  jvector_free(char, &parser->keys);
+  jvector_free(char, &parser->key);
+  jvector_free(int, &parser->live);
+}
+
+/* Release every member of the open containers. The error describing the
+ * failure survives the cleanup. */
+static void jparser_unwind(jparser_t* parser, jnode_t* value) {
+  jerror_keep({
+    jdelete(value);
+    jvector_foreach(i, parser->members) {
+      jdelete(jvector_get(parser->members, i)->value);
+    }
+    parser->members.len = 0;
+    parser->keys.len = 0;
+    parser->stack.len = 0;
+  });
+}
+
+static unsigned jhex4(const char* p) {
+  unsigned value = 0;
+  for (int i = 0; i < 4; i++) {
+    unsigned char c = p[i];
+    value = value << 4 | (jis_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+  }
+  return value;
+}
+
+/* Append the string body [p, end) to `out` with escapes resolved. The body
+ * was checked by the lexer. \u escapes become UTF-8, a lone surrogate
+ * becomes U+FFFD. */
+static int junescape(const char* p, const char* end, tv* out) {
+  for (;;) {
+    const char* bs = memchr(p, '\\', end - p);
+    const char* run_end = bs ? bs : end;
+    if (!jvector_concat(char, out, p, run_end - p)) return 0;
+    if (!bs) return 1;
+
+    char utf[4] = {bs[1]};
+    int n = 1;
+    p = bs + 2;
+    switch (bs[1]) {
+      case 'b': utf[0] = '\b'; break;
+      case 'f': utf[0] = '\f'; break;
+      case 'n': utf[0] = '\n'; break;
+      case 'r': utf[0] = '\r'; break;
+      case 't': utf[0] = '\t'; break;
+      case 'u': {
+        unsigned cp = jhex4(p);
+        p += 4;
+        if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' &&
+            p[1] == 'u') {
+          unsigned lo = jhex4(p + 2);
+          if (lo >= 0xDC00 && lo < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            p += 6;
+          }
+        }
+        if (cp >= 0xD800 && cp < 0xE000) cp = 0xFFFD;
+
+        if (cp < 0x80) {
+          utf[0] = cp;
+        } else if (cp < 0x800) {
+          utf[0] = 0xC0 | cp >> 6;
+          utf[1] = 0x80 | (cp & 0x3F);
+          n = 2;
+        } else if (cp < 0x10000) {
+          utf[0] = 0xE0 | cp >> 12;
+          utf[1] = 0x80 | (cp >> 6 & 0x3F);
+          utf[2] = 0x80 | (cp & 0x3F);
+          n = 3;
+        } else {
+          utf[0] = 0xF0 | cp >> 18;
+          utf[1] = 0x80 | (cp >> 12 & 0x3F);
+          utf[2] = 0x80 | (cp >> 6 & 0x3F);
+          utf[3] = 0x80 | (cp & 0x3F);
+          n = 4;
+        }
+        break;
+      }
+    }
+    if (!jvector_concat(char, out, utf, n)) return 0;
+  }
+}
+
+static jnode_t* jparse_string(jparser_t* parser, const char* body, int len) {
+  if (!len) return jstring_new(0, "");
+  if (!memchr(body, '\\', len)) return jstring_new(len, body);
+
+  tv* buf = jas_tv(&parser->key);
+  buf->len = 0;
+  if (!junescape(body, body + len, buf)) return 0;
+  return jstring_new(buf->len, buf->data);
+}
+
+/* Consume `"key" :` and remember the key on the innermost frame. */
+static int jparse_key(jparser_t* parser) {
+  if (!jparser_match(parser, JTK_STRING)) {
+    jparser_expect(parser, "a string");
+    return 0;
+  }
+  jframe_t* frame = jparser_top(parser);
+  frame->key = parser->tk.as.string;
+  frame->keylen = parser->tk.len - 2;
+  if (!jparser_advance(parser)) return 0;
+
+  if (!jparser_match(parser, ':')) {
+    jparser_expect(parser, "':'");
+    return 0;
+  }
+  return jparser_advance(parser);
+}
+
+static int jparse_open(jparser_t* parser, int object) {
+  if (jvector_len(parser->stack) >= parser->max_depth) {
+    const jtoken_t* tk = jparser_currptr(parser);
+    jlexer_error(&parser->lexer, JERR_DEPTH, jtoken_offset(&parser->lexer, tk),
+                 "Exceed maximum depth %d", parser->max_depth);
+    return 0;
+  }
+  jframe_t frame = {.object = object,
+                    .first = jvector_len(parser->members),
+                    .keys = jvector_len(parser->keys),
+                    .live = jvector_len(parser->live) - parser->npick,
+                    .nlive = parser->npick};
+  parser->npick = 0;
+  if (!jvector_concat(jframe_t, &parser->stack, &frame, 1)) return 0;
+  return jparser_advance(parser);
+}
+
+/* Hold `value` until its container closes. A value skipped by projection
+ * is 0: it leaves a null in an array, so that the kept elements do not
+ * move, and is dropped from an object. A skipped scalar some path went
+ * through is kept as an empty member instead, since it still replaces an
+ * earlier member with the same key. */
+static int jparse_attach(jparser_t* parser, jnode_t* value) {
+  jframe_t* frame = jparser_top(parser);
+  if (!value) {
+    if (frame->object && !parser->npick) return 1;
+    if (!frame->object) value = jnull_new();
+  } else {
+    frame->kept = jvector_len(parser->members) - frame->first + 1;
+  }
+  jmember_t member = {.value = value};
+  if (frame->object) {
+    tv* keys = jas_tv(&parser->keys);
+    member.key = keys->len;
+    if (!junescape(frame->key, frame->key + frame->keylen, keys) ||
+        !jvector_concat(char, keys, "", 1))
+      return 0;
+  }
+  return jvector_concat(jmember_t, &parser->members, &member, 1);
+}
+
+/* Pop the innermost container and make its node. Storage is allocated
+ * once at the final size; members move in without being copied. */
+static jnode_t* jparse_close(jparser_t* parser) {
+  jframe_t frame = *jparser_top(parser);
+  parser->stack.len--;
+  jmember_t* members = jvector_get(parser->members, frame.first);
+  int n = jvector_len(parser->members) - frame.first;
+  if (frame.nlive && !frame.object) n = frame.kept;  // drop trailing nulls
+
+  jnode_t* node = 0;
+  int moved = 0;
+  if (!frame.object) {
+    node = jarray_new();
+    jarray_t* jarr = node ? jas_array(node) : 0;
+    if (jarr && jvector_reserve(jnode_t*, &jarr->array, n)) {
+      for (; moved < n; moved++) {
+        jnode_t* value = members[moved].value;
+        jarr->array.data[moved] = value;
+        if (jis_linked(value)) jas_linked(value)->parent = node;
+      }
+      jarr->array.len = n;
+    }
+  } else {
+    node = jobject_alloc(jht_capacity_for(n));
+    const char* keys = jvector_data(parser->keys);
+    // jobject_put() takes the member even when it replaces a duplicate
+    for (; node && moved < n; moved++) {
+      const char* key = keys + members[moved].key;
+      jnode_t* value = members[moved].value;
+      if (!value) {
+        if (jobject_has(node, key)) jobject_put(node, key, 0);
+      } else if (!jobject_put(node, key, value)) {
+        break;
+      }
+    }
+  }
+
+  if (moved < n) {
+    jerror_keep({
+      jdelete(node);
+      for (int i = moved; i < n; i++) jdelete(members[i].value);
+    });
+    node = 0;
+  }
+  parser->members.len = frame.first;
+  parser->keys.len = frame.keys;
+  return node;
+}
+
+/* Set up projection: only the parts of the input selected by `paths` are
+ * made into nodes. Paths are matched while the input streams by, so they
+ * cannot count from the end of an array or search every level. */
+static int jparser_project(jparser_t* parser, const jparse_opts_t* opts) {
+  if (!opts || opts->npaths <= 0) return 1;
+  for (int i = 0; i < opts->npaths; i++) {
+    const jpath_t* path = opts->paths[i];
+    if (!path) {
+      jerror_log(JERR_ARG, "Null projection path.");
+      return 0;
+    }
+    jvector_foreach(j, path->steps) {
+      const jstep_t* step = jvector_get(path->steps, j);
+      if (step->kind == JSTEP_DESCEND ||
+          (step->kind == JSTEP_INDEX && step->index < 0)) {
+        jerror_log(JERR_ARG,
+                   "Projection path %d uses '..' or a negative index.", i);
+        return 0;
+      }
+    }
+    if (!jvector_concat(int, &parser->live, &i, 1)) return 0;
+  }
+  parser->paths = opts->paths;
+  parser->npaths = opts->npaths;
+  return 1;
+}
+
+enum jpick {
+  JPICK_FAIL = 0,
+  JPICK_KEEP,     // a path ends at the value, make all of it
+  JPICK_SKIP,     // no path goes through the value
+  JPICK_PROJECT,  // paths go on below the value
+};
+
+/* Match the paths of the innermost projected container against the value
+ * the parser is at. Those that select it are pushed on `live`, and their
+ * count is left in `npick` for jparse_open() when the value is projected.
+ * The root is selected by every path. */
+static int jparse_pick(jparser_t* parser) {
+  tv* live = jas_tv(&parser->live);
+  int depth = jvector_len(parser->stack);
+  int first = 0;
+  if (depth) {
+    jframe_t* frame = jparser_top(parser);
+    first = live->len = frame->live + frame->nlive;
+    int index = jvector_len(parser->members) - frame->first;
+    const char* key = frame->key;
+    int keylen = frame->keylen;
+    if (frame->object && memchr(key, '\\', keylen)) {
+      tv* buf = jas_tv(&parser->key);
+      buf->len = 0;
+      if (!junescape(key, key + keylen, buf)) return JPICK_FAIL;
+      key = buf->data;
+      keylen = buf->len;
+    }
+    for (int i = frame->live; i < first; i++) {
+      int id = jvector_data(parser->live)[i];
+      const jstep_t* step = jvector_get(parser->paths[id]->steps, depth - 1);
+      int match = step->kind == JSTEP_ALL;
+      if (!match && frame->object)
+        match = step->kind != JSTEP_INDEX && step->len == keylen &&
+                !memcmp(step->key, key, keylen);
+      else if (!match)
+        match = step->kind != JSTEP_KEY && step->index == index;
+      if (match && !jvector_concat(int, live, &id, 1)) return JPICK_FAIL;
+    }
+  }
+
+  parser->npick = live->len - first;
+  if (!parser->npick) return JPICK_SKIP;
+  for (int i = first; i < live->len; i++) {
+    int id = jvector_data(parser->live)[i];
+    if (jvector_len(parser->paths[id]->steps) == depth) {
+      parser->npick = 0;
+      return JPICK_KEEP;
+    }
+  }
+  return JPICK_PROJECT;
+}
+
+/* Skip an array or object whose opening bracket is the current token,
+ * without making tokens or nodes. Strings are checked as usual, the rest
+ * only has to balance its brackets. */
+static int jparse_skip(jparser_t* parser) {
+  jlexer_t* lexer = &parser->lexer;
+  const char* p = jlexer_currptr(lexer);
+  const char* end = jlexer_ptr(lexer, lexer->len);
+  int utf8 = lexer->flags & JPARSE_UTF8;
+  for (int depth = 1; depth;) {
+    p = jspan_structural(p, end);
+    if (p >= end) {
+      jlexer_error(lexer, JERR_SYNTAX, jtoken_offset(lexer, &parser->tk),
+                   "Unterminated %s",
+                   parser->tk.type == '[' ? "array" : "object");
+      return 0;
+    }
+    if (*p == '"') {
+      const char* bad = 0;
+      const char* close = jscan_string(p + 1, end, utf8, &bad);
+      if (!close) {
+        int code = bad < end && (unsigned char)*bad >= 0x80 ? JERR_UTF8
+                                                            : JERR_SYNTAX;
+        jlexer_error(lexer, code, bad - lexer->data, "%s",
+                     jscan_string_what(bad, end));
+        return 0;
+      }
+      p = close + 1;
+    } else {
+      depth += (*p++ | 0x20) == '{' ? 1 : -1;
+    }
+  }
+  lexer->curr = p - lexer->data;
+  return jparser_advance(parser);
+}
+
+/* Iterative parser. Open containers live on an explicit stack instead of the
+ * call stack, so nesting is bounded by `max_depth` rather than stack size. */
+static jnode_t* jparse(jparser_t* parser) {
+  for (;;) {
+    // 1. parse a value, descending into containers
+    jnode_t* value = 0;
+    const jtoken_t* tk = jparser_currptr(parser);
+    int pick = JPICK_KEEP;
+    if (jparser_projecting(parser) && !(pick = jparse_pick(parser)))
+      goto fail;
+    if (pick != JPICK_KEEP && jvector_len(parser->stack)) {
+      int container = tk->type == '[' || tk->type == '{';
+      int scalar = tk->type >= JTK_NULL && tk->type <= JTK_STRING;
+      // a projected path cannot go on below a scalar
+      if ((pick == JPICK_SKIP && container) || scalar) {
+        if (container ? !jparse_skip(parser) : !jparser_advance(parser))
+          goto fail;
+        goto attach;
+      }
+    }
+    switch (tk->type) {
+      case JTK_NULL: value = jnull_new(); break;
+      case JTK_TRUE: value = jbool_new(1); break;
+      case JTK_FALSE: value = jbool_new(0); break;
+      case JTK_NUMBER: {
+        value = jnumber_new(jnumber_parse(tk->lexeme, tk->len));
+        break;
+      }
+      case JTK_STRING: {
+        value = jparse_string(parser, tk->as.string, tk->len - 2);
+        break;
+      }
+
+      case '[': {
+        if (!jparse_open(parser, 0)) goto fail;
+        if (!jparser_match(parser, ']')) continue;
+        value = jparse_close(parser);
+        break;
+      }
+
+      case '{': {
+        if (!jparse_open(parser, 1)) goto fail;
+        if (!jparser_match(parser, '}')) {
+          if (!jparse_key(parser)) goto fail;
+          continue;
+        }
+        value = jparse_close(parser);
+        break;
+      }
+
+      default: {
+        jparser_expect(parser, "a value");
+        goto fail;
+      }
+    }
+    if (!value) goto fail;
+    if (!jparser_advance(parser)) goto fail_value;
+
+  attach:
+    // 2. attach the value, closing every container that ends here
+    for (;;) {
+      if (!jvector_len(parser->stack)) return value;
+      if (!jparse_attach(parser, value)) goto fail_value;
+
+      int object = jparser_top(parser)->object;
+      if (jparser_match(parser, ',')) {
+        if (!jparser_advance(parser)) goto fail;
+        if (object && !jparse_key(parser)) goto fail;
+        break;
+      }
+      if (!jparser_match(parser, object ? '}' : ']')) {
+        if (object) jparser_expect(parser, "',' or '}'");
+        else jparser_expect(parser, "',' or ']'");
+        goto fail;
+      }
+      if (!jparser_advance(parser)) goto fail;
+      if (!(value = jparse_close(parser))) goto fail;
+    }
+    continue;
+
+  fail_value:
+    // the value is not owned by any container yet
+    jparser_unwind(parser, value);
+    return 0;
+  }
+
+fail:
+  jparser_unwind(parser, 0);
+  return 0;
+}
+
+/* One JSON text in [buf + begin, buf + end), see jparser_init(). */
+static jnode_t* jparse_text(const char* buf, size_t begin, size_t end,
+                            const jparse_opts_t* opts) {
+  jparser_t parser;
+  jparser_init(&parser, buf, begin, end, opts);
+
+  jnode_t* json = 0;
+  if (jparser_project(&parser, opts) && jparser_advance(&parser))
+    json = jparse(&parser);
+  if (json && !jparser_is_end(&parser)) {
+    jparser_expect(&parser, "end of input");
+    jparser_unwind(&parser, json);
+    json = 0;
+  }
+
+  jparser_free(&parser);
+  return json;
+}
+
+jnode_t* jfrom_string_ex(const char* buf, size_t len,
+                         const jparse_opts_t* opts, jerr_t* err) {
+  jerror_clear();
+  jnode_t* json = jparse_text(buf, 0, len, opts);
+  if (err) {
+    if (json) err->code = JERR_NONE;
+    else *err = jerr_last;
+  }
+  return json;
+}
+
+jnode_t* jfrom_string_opts(const char* json_str, const jparse_opts_t* opts) {
+  return jfrom_string_ex(json_str, strlen(json_str), opts, 0);
+}
+
+jnode_t* jfrom_string(const char* json_str) {
+  return jfrom_string_ex(json_str, strlen(json_str), 0, 0);
+}
+
+/* ==============================
+ *          7. VALIDATION
  * ============================== */
 
-int jarray_size(jnode_t* jnode) {
+#define jvalidator_bits(v) ((v)->stack ? (v)->stack : (v)->local)
+#define jvalidator_in_object(v) \
+  (jvalidator_bits(v)[((v)->depth - 1) / 8] & (1 << (((v)->depth - 1) % 8)))
+#define jvalidator_skip_blank(p, end) \
+  while ((p) < (end) && jis_blank(*(p))) (p)++
+
+/* One bit per open container: set for objects, clear for arrays. */
+typedef struct jvalidator {
+  int depth;
+  int max_depth;
+  unsigned char* stack;  // heap bits, only when `local` is too small
+  unsigned char local[SJSON_MAX_DEPTH / 8];
+} jvalidator_t;
+
+static int jvalidator_push(jvalidator_t* v, int object) {
+  if (v->depth >= v->max_depth) return 0;
+  unsigned char* bits = jvalidator_bits(v);
+  unsigned char mask = 1 << (v->depth % 8);
+  if (object) bits[v->depth / 8] |= mask;
+  else bits[v->depth / 8] &= ~mask;
+  v->depth++;
+  return 1;
+}
+
+static int jvalidate_fail(const char* buf, const char* p, int code,
+                          const char* what, jerr_t* err) {
+  int line, col;
+  jlinecol(buf, p - buf, &line, &col);
+  jerror_log(code, "%s" jlinecol_str, what, line, col);
+  jerror_locate(p - buf, line, col);
+  if (err) *err = jerr_last;
+  return 0;
+}
+
+/* Grammar check without building nodes. Memory use is one bit per level of
+ * nesting. */
+int jvalidate_opts(const char* buf, size_t len, const jparse_opts_t* opts,
+                   jerr_t* err) {
   jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  return jvector_len(jarr->array);
+  if (err) err->code = JERR_NONE;
+  jvalidator_t v = {.max_depth = SJSON_MAX_DEPTH};
+  if (opts && opts->max_depth > 0) v.max_depth = opts->max_depth;
+  int utf8 = opts && (opts->flags & JPARSE_UTF8);
+  if (v.max_depth > SJSON_MAX_DEPTH) {
+    v.stack = reallocate(0, 0, (v.max_depth + 7) / 8);
+    if (!v.stack) {
+      if (err) *err = jerr_last;
+      return 0;
+    }
+  }
+
+  const char* p = buf;
+  const char* end = buf + len;
+  const char* bad = 0;
+  int code = JERR_SYNTAX;
+  const char* what = 0;
+
+value:
+  jvalidator_skip_blank(p, end);
+  if (p >= end) {
+    what = "Expect a value but got end of input";
+    goto fail;
+  }
+  switch (*p) {
+    case '{':
+    case '[': {
+      int object = *p == '{';
+      if (!jvalidator_push(&v, object)) {
+        code = JERR_DEPTH;
+        what = "Exceed maximum depth";
+        goto fail;
+      }
+      p++;
+      jvalidator_skip_blank(p, end);
+      if (p < end && *p == (object ? '}' : ']')) {
+        p++;
+        v.depth--;
+        goto next;
+      }
+      if (object) goto key;
+      goto value;
+    }
+    case '"': {
+      const char* close = jscan_string(p + 1, end, utf8, &bad);
+      if (!close) goto fail_string;
+      p = close + 1;
+      goto next;
+    }
+    case 't':
+    case 'f':
+    case 'n': {
+      const char* keyword = *p == 't' ? "true" : *p == 'f' ? "false" : "null";
+      size_t n = strlen(keyword);
+      if ((size_t)(end - p) < n || memcmp(p, keyword, n)) {
+        what = "Invalid literal";
+        goto fail;
+      }
+      p += n;
+      goto next;
+    }
+    default: {
+      const char* num = jscan_number(p, end);
+      if (!num) {
+        what = jis_digit(*p) || *p == '-' ? "Unknown number format"
+                                          : "Expect a value";
+        goto fail;
+      }
+      p = num;
+      goto next;
+    }
+  }
+
+key:
+  jvalidator_skip_blank(p, end);
+  if (p >= end || *p != '"') {
+    what = "Expect a string";
+    goto fail;
+  } else {
+    const char* close = jscan_string(p + 1, end, utf8, &bad);
+    if (!close) goto fail_string;
+    p = close + 1;
+  }
+  jvalidator_skip_blank(p, end);
+  if (p >= end || *p != ':') {
+    what = "Expect ':'";
+    goto fail;
+  }
+  p++;
+  goto value;
+
+next:
+  jvalidator_skip_blank(p, end);
+  if (!v.depth) {
+    if (p < end) {
+      what = "Expect end of input";
+      goto fail;
+    }
+    reallocate(v.stack, 0, 0);
+    return 1;
+  }
+  if (p < end && *p == ',') {
+    p++;
+    if (jvalidator_in_object(&v)) goto key;
+    goto value;
+  }
+  if (p < end && *p == (jvalidator_in_object(&v) ? '}' : ']')) {
+    p++;
+    v.depth--;
+    goto next;
+  }
+  what = jvalidator_in_object(&v) ? "Expect ',' or '}'" : "Expect ',' or ']'";
+  goto fail;
+
+fail_string:
+  what = jscan_string_what(bad, end);
+  if (bad < end && (unsigned char)*bad >= 0x80) code = JERR_UTF8;
+  p = bad;
+fail:
+  reallocate(v.stack, 0, 0);
+  return jvalidate_fail(buf, p, code, what, err);
+}
+
+int jvalidate(const char* buf, size_t len, jerr_t* err) {
+  return jvalidate_opts(buf, len, 0, err);
+}
+
+/* ==============================
+ *          8. PATH QUERY
+ * ============================== */
+
+typedef struct jpath_run {
+  const jpath_t* path;
+  int (*f)(jnode_t*, void*);
+  void* ctx;
+} jpath_run_t;
+
+/* Steps left to apply below each node of a recursive descent. */
+typedef struct jpath_descent {
+  jpath_run_t* run;
+  int step;
+} jpath_descent_t;
+
+typedef struct jpath_select {
+  jnode_t** out;
+  int cap;
+  int len;
+} jpath_select_t;
+
+static jpath_t* jpath_alloc() {
+  jpath_t* path = reallocate(0, 0, sizeof(jpath_t));
+  if (!path) return 0;
+  path->single = 1;
+  jvector_init(jstep_t, &path->steps);
+  return path;
+}
+
+/* Append a step which takes ownership of `key` (may be 0), even on
+ * failure. */
+static int jpath_push(jpath_t* path, int kind, int index, char* key) {
+  jstep_t step = {.kind = kind, .index = index, .key = key};
+  if (key) {
+    step.len = strlen(key);
+    step.hash = fnv1a(key);
+  }
+  if (kind == JSTEP_ALL || kind == JSTEP_DESCEND) path->single = 0;
+  if (jvector_concat(jstep_t, &path->steps, &step, 1)) return 1;
+  reallocate(key, 0, 0);
+  return 0;
+}
+
+/* Value of `len` digits without leading zeros, -1 if `s` is not one. */
+static int jpath_index(const char* s, int len) {
+  if (len <= 0 || (s[0] == '0' && len > 1)) return -1;
+  int index = 0;
+  for (int i = 0; i < len; i++) {
+    if (!isdigit((unsigned char)s[i]) || index > (INT_MAX - 9) / 10)
+      return -1;
+    index = index * 10 + s[i] - '0';
+  }
+  return index;
+}
+
+jpath_t* jpointer_compile(const char* pointer) {
+  jerror_clear();
+  if (!pointer) {
+    jerror_log(JERR_ARG, "Null pointer.");
+    return 0;
+  }
+  if (*pointer && *pointer != '/') {
+    jerror_log(JERR_SYNTAX, "Expect '/' at offset 0 of pointer '%s'.",
+               pointer);
+    return 0;
+  }
+
+  jpath_t* path = jpath_alloc();
+  if (!path) return 0;
+  for (const char* p = pointer; *p;) {
+    const char* token = ++p;
+    while (*p && *p != '/') p++;
+    char* key = reallocate(0, 0, p - token + 1);
+    if (!key) goto fail;
+    int len = 0;
+    for (const char* q = token; q < p; q++) {
+      if (*q != '~') {
+        key[len++] = *q;
+      } else if (q[1] == '0' || q[1] == '1') {
+        key[len++] = *++q == '0' ? '~' : '/';
+      } else {
+        jerror_log(JERR_SYNTAX,
+                   "Expect '0' or '1' after '~' at offset %d of pointer '%s'.",
+                   (int)(q + 1 - pointer), pointer);
+        reallocate(key, 0, 0);
+        goto fail;
+      }
+    }
+    key[len] = 0;
+    int index = jpath_index(token, p - token);
+    if (!jpath_push(path, JSTEP_MEMBER, index, key)) goto fail;
+  }
+  return path;
+
+fail:
+  jpath_free(path);
+  return 0;
+}
+
+jpath_t* jpath_compile(const char* query) {
+  jerror_clear();
+  if (!query) {
+    jerror_log(JERR_ARG, "Null path.");
+    return 0;
+  }
+
+  if (*query != '$') {
+    jerror_log(JERR_SYNTAX, "Expect '$' at offset 0 of path '%s'.", query);
+    return 0;
+  }
+
+  jpath_t* path = jpath_alloc();
+  if (!path) return 0;
+  const char* p = query + 1;
+  const char* what = 0;
+  while (*p) {
+    int dot = *p == '.';
+    if (dot) {
+      p++;
+      if (*p == '.') {
+        p++;
+        if (!jpath_push(path, JSTEP_DESCEND, 0, 0)) goto fail;
+        if (*p == '[') dot = 0;  // `..[0]` and `..['key']`
+      }
+    }
+
+    if (dot && *p == '*') {
+      p++;
+      if (!jpath_push(path, JSTEP_ALL, 0, 0)) goto fail;
+    } else if (dot) {
+      const char* name = p;
+      while (*p && *p != '.' && *p != '[') p++;
+      what = "Expect a member name";
+      if (p == name) goto fail_syntax;
+      char* key = reallocate(0, 0, p - name + 1);
+      if (!key) goto fail;
+      memcpy(key, name, p - name);
+      key[p - name] = 0;
+      if (!jpath_push(path, JSTEP_KEY, 0, key)) goto fail;
+    } else if (*p == '[') {
+      p++;
+      if (*p == '*') {
+        p++;
+        if (!jpath_push(path, JSTEP_ALL, 0, 0)) goto fail;
+      } else if (*p == '\'' || *p == '"') {
+        char quote = *p++;
+        const char* name = p;
+        while (*p && *p != quote) p += p[0] == '\\' && p[1] ? 2 : 1;
+        what = "Unterminated name";
+        if (!*p) goto fail_syntax;
+        char* key = reallocate(0, 0, p - name + 1);
+        if (!key) goto fail;
+        int len = 0;
+        for (const char* q = name; q < p; q++) {
+          key[len++] = *q == '\\' ? *++q : *q;
+        }
+        key[len] = 0;
+        p++;
+        if (!jpath_push(path, JSTEP_KEY, 0, key)) goto fail;
+      } else {
+        int negative = *p == '-';
+        if (negative) p++;
+        const char* digits = p;
+        while (isdigit((unsigned char)*p)) p++;
+        int index = jpath_index(digits, p - digits);
+        what = "Expect an index, a quoted name or '*'";
+        if (index < 0) {
+          p = digits - negative;
+          goto fail_syntax;
+        }
+        if (!jpath_push(path, JSTEP_INDEX, negative ? -index : index, 0))
+          goto fail;
+      }
+      what = "Expect ']'";
+      if (*p++ != ']') {
+        p--;
+        goto fail_syntax;
+      }
+    } else {
+      what = "Expect '.' or '['";
+      goto fail_syntax;
+    }
+  }
+  return path;
+
+fail_syntax:
+  jerror_log(JERR_SYNTAX, "%s at offset %d of path '%s'.", what,
+             (int)(p - query), query);
+fail:
+  jpath_free(path);
+  return 0;
+}
+
+void jpath_free(jpath_t* path) {
+  if (!path) return;
+  jvector_foreach(i, path->steps) {
+    reallocate(jvector_get(path->steps, i)->key, 0, 0);
+  }
+  jvector_free(jstep_t, &path->steps);
+  reallocate(path, sizeof(jpath_t), 0);
+}
+
+/* Member of `node` named by a key, index or pointer step, 0 if none. */
+static jnode_t* jpath_child(jnode_t* node, const jstep_t* step) {
+  if (jis_object(node) && step->kind != JSTEP_INDEX) {
+    jkv_t* kv = jobject_find(jas_object(node), step->key, step->hash);
+    return kv ? kv->value : 0;
+  }
+  if (jis_array(node) && step->kind != JSTEP_KEY) {
+    jarray_t* jarr = jas_array(node);
+    int index = step->index;
+    if (index < 0 && step->kind == JSTEP_INDEX)
+      index += jvector_len(jarr->array);
+    if (index < 0 || index >= jvector_len(jarr->array)) return 0;
+    return *jvector_get(jarr->array, index);
+  }
+  return 0;
+}
+
+/* Log why jpath_child() found nothing. */
+static void jpath_miss(jnode_t* node, const jstep_t* step) {
+  if (jis_object(node) && step->kind != JSTEP_INDEX) {
+    jerror_log(JERR_KEY, "Key '%s' not exists.", step->key);
+  } else if (jis_array(node) && step->kind == JSTEP_INDEX) {
+    jerror_log(JERR_INDEX, "Invalid index '%d'.", step->index);
+  } else if (jis_array(node) && step->kind == JSTEP_MEMBER) {
+    jerror_log(JERR_INDEX, "Invalid index '%s'.", step->key);
+  } else {
+    jerror_log(JERR_TYPE, "Expect type '%s' but got type '%s'",
+               step->kind == JSTEP_KEY     ? "object"
+               : step->kind == JSTEP_INDEX ? "array"
+                                           : "array' or 'object",
+               type_str[jtype(node)]);
+  }
+}
+
+static int jpath_exec(jpath_run_t* run, int step, jnode_t* node);
+
+static int jpath_descend(const jvisit_t* visit, void* ctx) {
+  jpath_descent_t* descent = ctx;
+  return jpath_exec(descent->run, descent->step, visit->node);
+}
+
+/* Apply the steps from `step` on to `node` and report each match. Return 0
+ * when the callback stops or memory runs out. Recursion only goes as deep
+ * as the number of steps. */
+static int jpath_exec(jpath_run_t* run, int step, jnode_t* node) {
+  const jpath_t* path = run->path;
+  for (; step < jvector_len(path->steps); step++) {
+    const jstep_t* s = jvector_get(path->steps, step);
+    if (s->kind == JSTEP_DESCEND) {
+      jpath_descent_t descent = {.run = run, .step = step + 1};
+      return jwalk_ex(node, jpath_descend, 0, &descent, 0);
+    }
+    if (s->kind == JSTEP_ALL) {
+      if (!jis_array(node) && !jis_object(node)) return 1;
+      jiter_t it = {.node = node, .index = -1, .bucket = -1};
+      while (jiter_next(&it)) {
+        if (!jpath_exec(run, step + 1, it.value)) return 0;
+      }
+      return 1;
+    }
+    if (!(node = jpath_child(node, s))) return 1;
+  }
+  return run->f(node, run->ctx);
+}
+
+static int jpath_first(jnode_t* node, void* ctx) {
+  *(jnode_t**)ctx = node;
+  return 0;
+}
+
+static int jpath_collect(jnode_t* node, void* ctx) {
+  jpath_select_t* select = ctx;
+  if (select->len < select->cap) select->out[select->len] = node;
+  select->len++;
+  return 1;
+}
+
+jnode_t* jpath_get(const jpath_t* path, jnode_t* jnode) {
+  jerror_clear();
+  if (!path->single) {
+    jnode_t* first = 0;
+    jpath_run_t run = {.path = path, .f = jpath_first, .ctx = &first};
+    jpath_exec(&run, 0, jnode);
+    if (!first && !jerror()) jerror_log(JERR_KEY, "Path matches nothing.");
+    return first;
+  }
+
+  jvector_foreach(i, path->steps) {
+    const jstep_t* step = jvector_get(path->steps, i);
+    jnode_t* child = jpath_child(jnode, step);
+    if (!child) {
+      jpath_miss(jnode, step);
+      return 0;
+    }
+    jnode = child;
+  }
+  return jnode;
+}
+
+int jpath_foreach(const jpath_t* path, jnode_t* jnode,
+                  int (*f)(jnode_t*, void*), void* ctx) {
+  jerror_clear();
+  jpath_run_t run = {.path = path, .f = f, .ctx = ctx};
+  return jpath_exec(&run, 0, jnode);
+}
+
+int jpath_select(const jpath_t* path, jnode_t* jnode, jnode_t** out,
+                 int cap) {
+  jerror_clear();
+  jpath_select_t select = {.out = out, .cap = cap};
+  jpath_run_t run = {.path = path, .f = jpath_collect, .ctx = &select};
+  if (!jpath_exec(&run, 0, jnode)) return -1;
+  return select.len;
+}
+
+jnode_t* jpointer_get(jnode_t* jnode, const char* pointer) {
+  jpath_t* path = jpointer_compile(pointer);
+  if (!path) return 0;
+  jnode_t* found = jpath_get(path, jnode);
+  jpath_free(path);
+  return found;
+}
+
+/* ==============================
+ *          9. BINDING
+ * ============================== */
+
+/* Keys are sorted by length, then bytes, so a lookup compares lengths
+ * before it touches any key. */
+struct jschema_key {
+  int len;
+  const jfield_t* field;
+};
+
+static const char* jbind_type_str[] = {
+    "", "a boolean", "an integer", "an integer", "a number", "a string",
+    "an object", "an array"};
+
+static int jschema_key_cmp(const void* a, const void* b) {
+  const struct jschema_key* x = a;
+  const struct jschema_key* y = b;
+  if (x->len != y->len) return x->len < y->len ? -1 : 1;
+  return memcmp(x->field->key, y->field->key, x->len);
+}
+
+static int jschema_check(const jfield_t* field) {
+  int item = field->type == JBIND_ARRAY ? field->item : field->type;
+  if (!field->key) {
+    jerror_log(JERR_ARG, "Null key in schema.");
+  } else if (field->type < JBIND_BOOL || field->type > JBIND_ARRAY ||
+             item < JBIND_BOOL || item >= JBIND_ARRAY) {
+    jerror_log(JERR_ARG, "Invalid type of field '%s'.", field->key);
+  } else if (item == JBIND_OBJECT && !field->schema) {
+    jerror_log(JERR_ARG, "Field '%s' has no schema.", field->key);
+  } else if (field->type == JBIND_ARRAY && !field->item_size) {
+    jerror_log(JERR_ARG, "Field '%s' has no item size.", field->key);
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+int jschema_prepare(jschema_t* schema) {
+  jerror_clear();
+  if (schema->keys) return 1;
+  for (int i = 0; i < schema->nfields; i++) {
+    if (!jschema_check(schema->fields + i)) return 0;
+  }
+
+  int n = schema->nfields;
+  struct jschema_key* keys = reallocate(0, 0, (n ? n : 1) * sizeof(*keys));
+  if (!keys) return 0;
+  for (int i = 0; i < n; i++) {
+    keys[i] = (struct jschema_key){.len = strlen(schema->fields[i].key),
+                                   .field = schema->fields + i};
+  }
+  qsort(keys, n, sizeof(*keys), jschema_key_cmp);
+  for (int i = 1; i < n; i++) {
+    if (!jschema_key_cmp(keys + i - 1, keys + i)) {
+      jerror_log(JERR_ARG, "Duplicate key '%s' in schema.",
+                 keys[i].field->key);
+      reallocate(keys, 0, 0);
+      return 0;
+    }
+  }
+
+  // set before the nested schemas, which may refer back to this one
+  schema->keys = keys;
+  for (int i = 0; i < n; i++) {
+    jschema_t* nested = schema->fields[i].schema;
+    if (nested && !jschema_prepare(nested)) return 0;
+  }
+  return 1;
+}
+
+void jschema_release(jschema_t* schema) {
+  if (!schema->keys) return;
+  reallocate(schema->keys, 0, 0);
+  schema->keys = 0;
+  for (int i = 0; i < schema->nfields; i++) {
+    if (schema->fields[i].schema) jschema_release(schema->fields[i].schema);
+  }
+}
+
+/* Field bound to the key [key, key + len), 0 if the schema has none. */
+static const jfield_t* jschema_find(const jschema_t* schema, const char* key,
+                                    int len) {
+  int lo = 0, hi = schema->nfields;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    const struct jschema_key* k = schema->keys + mid;
+    int cmp = k->len != len ? (k->len < len ? -1 : 1)
+                            : memcmp(k->field->key, key, len);
+    if (!cmp) return k->field;
+    if (cmp < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return 0;
+}
+
+static size_t jbind_size(const jfield_t* field, int type) {
+  switch (type) {
+    case JBIND_INT64: return sizeof(int64_t);
+    case JBIND_DOUBLE: return sizeof(double);
+    case JBIND_STRING: return sizeof(char*);
+    case JBIND_OBJECT: return field->schema->size;
+    case JBIND_ARRAY: return sizeof(void*);
+    default: return sizeof(int);
+  }
+}
+
+#define jbind_count(field, member) \
+  jcast((char*)(member) - (field)->offset + (field)->count, int*)
+
+/* Free what a member owns and zero it. */
+static void jbind_clear(const jfield_t* field, int type, void* member) {
+  switch (type) {
+    case JBIND_STRING: reallocate(*(char**)member, 0, 0); break;
+    case JBIND_OBJECT: jbind_free(field->schema, member); break;
+    case JBIND_ARRAY: {
+      char* items = *(char**)member;
+      int* count = jbind_count(field, member);
+      for (int i = 0; items && i < *count; i++)
+        jbind_clear(field, field->item, items + i * field->item_size);
+      reallocate(items, 0, 0);
+      *count = 0;
+      break;
+    }
+  }
+  memset(member, 0, jbind_size(field, type));
+}
+
+void jbind_free(const jschema_t* schema, void* dst) {
+  for (int i = 0; i < schema->nfields; i++) {
+    const jfield_t* field = schema->fields + i;
+    jbind_clear(field, field->type, (char*)dst + field->offset);
+  }
+}
+
+/* Whether the double `d` holds an int64_t exactly. */
+#define jis_int64(d) \
+  ((d) >= -0x1p63 && (d) < 0x1p63 && (double)(int64_t)(d) == (d))
+
+/* Exact value of a number token in [min, max]. Digits are read as they
+ * are, so 64-bit integers beyond 2^53 keep every digit. A fraction or an
+ * exponent is accepted when the value is still integral. */
+static int jbind_integer(const jtoken_t* tk, int64_t min, int64_t max,
+                         int64_t* out) {
+  const char* p = tk->lexeme;
+  const char* end = p + tk->len;
+  int neg = *p == '-';
+  uint64_t value = 0;
+  for (p += neg; p < end && jis_digit(*p); p++) {
+    if (value > (UINT64_MAX - 9) / 10) return 0;
+    value = value * 10 + (*p - '0');
+  }
+  if (p < end) {
+    double d = jnumber_parse(tk->lexeme, tk->len);
+    if (!jis_int64(d)) return 0;
+    *out = (int64_t)d;
+  } else if (neg) {
+    if (value > (uint64_t)INT64_MAX + 1) return 0;
+    *out = (int64_t)(0 - value);
+  } else {
+    if (value > INT64_MAX) return 0;
+    *out = (int64_t)value;
+  }
+  return *out >= min && *out <= max;
+}
+
+static int jbind_open(jparser_t* parser, int depth) {
+  if (depth <= parser->max_depth) return jparser_advance(parser);
+  const jtoken_t* tk = jparser_currptr(parser);
+  jlexer_error(&parser->lexer, JERR_DEPTH, jtoken_offset(&parser->lexer, tk),
+               "Exceed maximum depth %d", parser->max_depth);
+  return 0;
+}
+
+/* Skip a value the schema does not bind. */
+static int jbind_skip(jparser_t* parser) {
+  int type = jparser_currptr(parser)->type;
+  if (type == '[' || type == '{') return jparse_skip(parser);
+  if (type >= JTK_NULL && type <= JTK_STRING) return jparser_advance(parser);
+  jparser_expect(parser, "a value");
+  return 0;
+}
+
+static int jbind_value(jparser_t* parser, const jfield_t* field, int type,
+                       void* member, int depth);
+
+/* Consume `"key" :`. The unescaped key stays valid until the next value
+ * is decoded. */
+static int jbind_key(jparser_t* parser, const char** key, int* len) {
+  const jtoken_t* tk = jparser_currptr(parser);
+  if (!jparser_match(parser, JTK_STRING)) {
+    jparser_expect(parser, "a string");
+    return 0;
+  }
+  *key = tk->as.string;
+  *len = tk->len - 2;
+  if (memchr(*key, '\\', *len)) {
+    tv* buf = jas_tv(&parser->key);
+    buf->len = 0;
+    if (!junescape(*key, *key + *len, buf)) return 0;
+    *key = buf->data;
+    *len = buf->len;
+  }
+  if (!jparser_advance(parser)) return 0;
+  if (!jparser_match(parser, ':')) {
+    jparser_expect(parser, "':'");
+    return 0;
+  }
+  return jparser_advance(parser);
+}
+
+static int jbind_object(jparser_t* parser, const jschema_t* schema,
+                        void* dst, int depth) {
+  if (!jbind_open(parser, depth)) return 0;
+  if (jparser_match(parser, '}')) return jparser_advance(parser);
+  for (;;) {
+    const char* key;
+    int len;
+    if (!jbind_key(parser, &key, &len)) return 0;
+    const jfield_t* field = jschema_find(schema, key, len);
+    if (field) {
+      // a repeated key replaces the earlier value
+      void* member = (char*)dst + field->offset;
+      jbind_clear(field, field->type, member);
+      if (!jbind_value(parser, field, field->type, member, depth)) return 0;
+    } else if (!jbind_skip(parser)) {
+      return 0;
+    }
+
+    if (jparser_match(parser, '}')) return jparser_advance(parser);
+    if (!jparser_match(parser, ',')) {
+      jparser_expect(parser, "',' or '}'");
+      return 0;
+    }
+    if (!jparser_advance(parser)) return 0;
+  }
+}
+
+/* Items are decoded in place into storage grown by doubling, and handed
+ * to the member at the end. */
+static int jbind_array(jparser_t* parser, const jfield_t* field,
+                       void* member, int depth) {
+  if (!jbind_open(parser, depth)) return 0;
+  tv items;
+  jvector_init(char, &items);
+  int ok = 1;
+  if (jparser_match(parser, ']')) {
+    ok = jparser_advance(parser);
+  } else {
+    for (;;) {
+      if (!tvector_grow(&items, items.len + 1, field->item_size)) {
+        ok = 0;
+        break;
+      }
+      char* item = (char*)items.data + items.len++ * field->item_size;
+      memset(item, 0, field->item_size);
+      if (!jbind_value(parser, field, field->item, item, depth)) {
+        ok = 0;
+        break;
+      }
+      if (jparser_match(parser, ']')) {
+        ok = jparser_advance(parser);
+        break;
+      }
+      if (!jparser_match(parser, ',')) {
+        jparser_expect(parser, "',' or ']'");
+        ok = 0;
+        break;
+      }
+      if (!(ok = jparser_advance(parser))) break;
+    }
+  }
+  // the member owns the items from here on, and frees them on failure
+  *(void**)member = items.data;
+  *jbind_count(field, member) = items.len;
+  return ok;
+}
+
+static int jbind_value(jparser_t* parser, const jfield_t* field, int type,
+                       void* member, int depth) {
+  const jtoken_t* tk = jparser_currptr(parser);
+  if (tk->type == JTK_NULL) return jparser_advance(parser);
+  switch (type) {
+    case JBIND_BOOL: {
+      if (tk->type != JTK_TRUE && tk->type != JTK_FALSE) break;
+      *(int*)member = tk->type == JTK_TRUE;
+      return jparser_advance(parser);
+    }
+    case JBIND_INT: {
+      int64_t value;
+      if (tk->type != JTK_NUMBER ||
+          !jbind_integer(tk, INT_MIN, INT_MAX, &value))
+        break;
+      *(int*)member = value;
+      return jparser_advance(parser);
+    }
+    case JBIND_INT64: {
+      if (tk->type != JTK_NUMBER ||
+          !jbind_integer(tk, INT64_MIN, INT64_MAX, member))
+        break;
+      return jparser_advance(parser);
+    }
+    case JBIND_DOUBLE: {
+      if (tk->type != JTK_NUMBER) break;
+      *(double*)member = jnumber_parse(tk->lexeme, tk->len);
+      return jparser_advance(parser);
+    }
+    case JBIND_STRING: {
+      if (tk->type != JTK_STRING) break;
+      tv* buf = jas_tv(&parser->key);
+      buf->len = 0;
+      char* string;
+      if (!junescape(tk->as.string, tk->as.string + tk->len - 2, buf) ||
+          !(string = reallocate(0, 0, buf->len + 1)))
+        return 0;
+      memcpy(string, buf->data, buf->len);
+      string[buf->len] = '\0';
+      *(char**)member = string;
+      return jparser_advance(parser);
+    }
+    case JBIND_OBJECT: {
+      if (tk->type != '{') break;
+      return jbind_object(parser, field->schema, member, depth + 1);
+    }
+    case JBIND_ARRAY: {
+      if (tk->type != '[') break;
+      return jbind_array(parser, field, member, depth + 1);
+    }
+  }
+  int rest = tk->len < 16 ? tk->len : 16;
+  jlexer_error(&parser->lexer, JERR_TYPE, jtoken_offset(&parser->lexer, tk),
+               "Expect %s for '%s' but got '%.*s'", jbind_type_str[type],
+               field->key, rest, tk->lexeme);
+  return 0;
+}
+
+int jbind_decode(const jschema_t* schema, void* dst, const char* buf,
+                 size_t len, const jparse_opts_t* opts, jerr_t* err) {
+  jerror_clear();
+  memset(dst, 0, schema->size);
+  jparser_t parser;
+  jparser_init(&parser, buf, 0, len, opts);
+
+  int ok = 0;
+  if (!schema->keys) {
+    jerror_log(JERR_ARG, "Schema is not prepared.");
+  } else if (parser.max_depth > SJSON_MAX_DEPTH) {
+    // decoding, freeing and writing recurse once per level
+    jerror_log(JERR_ARG, "Binding depth is limited to %d.", SJSON_MAX_DEPTH);
+  } else if (jparser_advance(&parser)) {
+    if (!jparser_match(&parser, '{')) jparser_expect(&parser, "an object");
+    else ok = jbind_object(&parser, schema, dst, 1);
+  }
+  if (ok && !jparser_is_end(&parser)) {
+    jparser_expect(&parser, "end of input");
+    ok = 0;
+  }
+
+  jparser_free(&parser);
+  if (!ok) jerror_keep(jbind_free(schema, dst));
+  if (err) {
+    if (ok) err->code = JERR_NONE;
+    else *err = jerr_last;
+  }
+  return ok;
+}
+
+static int jbind_write_object(jwriter_t* writer, const jschema_t* schema,
+                              const void* src);
+
+static int jbind_write_value(jwriter_t* writer, const jfield_t* field,
+                             int type, const void* member) {
+  switch (type) {
+    case JBIND_BOOL: return jwriter_value_bool(writer, *(const int*)member);
+    case JBIND_INT: return jwriter_value_number(writer, *(const int*)member);
+    case JBIND_INT64: {
+      // through the text, since a double cannot hold every int64_t
+      char buffer[32];
+      int len = sprintf(buffer, "%lld", (long long)*(const int64_t*)member);
+      jerror_clear();
+      jemitter_t em = jwriter_emitter(writer);
+      if (!jwriter_value_start(writer, &em)) return 0;
+      return jwriter_value_end(writer, jsink_write(em.sink, buffer, len));
+    }
+    case JBIND_DOUBLE: {
+      return jwriter_value_number(writer, *(const double*)member);
+    }
+    case JBIND_STRING: {
+      const char* string = *(char* const*)member;
+      if (!string) return jwriter_value_null(writer);
+      return jwriter_value_string(writer, string, 0);
+    }
+    case JBIND_OBJECT: {
+      return jbind_write_object(writer, field->schema, member);
+    }
+    case JBIND_ARRAY: {
+      const char* items = *(char* const*)member;
+      int count = *jbind_count(field, member);
+      if (!jwriter_begin_array(writer)) return 0;
+      for (int i = 0; items && i < count; i++) {
+        const void* item = items + i * field->item_size;
+        if (!jbind_write_value(writer, field, field->item, item)) return 0;
+      }
+      return jwriter_end_array(writer);
+    }
+  }
+  return 0;
+}
+
+static int jbind_write_object(jwriter_t* writer, const jschema_t* schema,
+                              const void* src) {
+  if (!jwriter_begin_object(writer)) return 0;
+  for (int i = 0; i < schema->nfields; i++) {
+    const jfield_t* field = schema->fields + i;
+    if (!jwriter_key(writer, field->key, 0) ||
+        !jbind_write_value(writer, field, field->type,
+                           (const char*)src + field->offset))
+      return 0;
+  }
+  return jwriter_end_object(writer);
 }
 
-jnode_t* jarray_get(jnode_t* jnode, int index) {
+int jbind_write(jwriter_t* writer, const jschema_t* schema,
+                const void* src) {
   jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  return *jvector_get(jarr->array, index);
+  if (!schema->keys) {
+    jerror_log(JERR_ARG, "Schema is not prepared.");
+    return 0;
+  }
+  return jbind_write_object(writer, schema, src);
 }
 
-int jarray_add(jnode_t* jnode, jnode_t* value) {
-  jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  return jvector_concat(jnode_t*, &jarr->array, &value, 1);
+static int jbind_append(const char* data, size_t len, void* ctx) {
+  return jvector_concat(char, ctx, data, len);
 }
 
-int jarray_insert(jnode_t* jnode, int index, jnode_t* value) {
-  jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  return jvector_insert(jnode_t*, &jarr->array, index, &value, 1);
+char* jbind_to_string(const jschema_t* schema, const void* src,
+                      const jwrite_opts_t* opts) {
+  tv out;
+  jvector_init(char, &out);
+  jsink_t sink;
+  jsink_init_callback(&sink, jbind_append, &out, 0, 0);
+  jwriter_t writer;
+  jwriter_init_opts(&writer, &sink, opts);
+
+  if (jbind_write(&writer, schema, src) && jwriter_finish(&writer) &&
+      jvector_concat(char, &out, "", 1))
+    return out.data;
+  jerror_keep(jvector_free(char, &out));
+  return 0;
 }
 
-int jarray_pop(jnode_t* jnode) {
-  jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  jnode_t* item = *jvector_pop(jnode_t*, &jarr->array, 1);
-  if (item) {
-    jdelete(item);
-    return 1;
-  } else {
-    jerror_log("Array is empty.");
+/* ==============================
+ *          10. COLUMNS
+ * ============================== */
+
+static const char* jcolumn_type_str[] = {"", "a number", "an integer",
+                                         "a string"};
+
+#define jcolumn_size(type) \
+  ((type) == JCOLUMN_STRING ? sizeof(jstrview_t) : sizeof(int64_t))
+#define jcolumn_cell(col, row) \
+  ((char*)(col)->cells + (size_t)(row) * jcolumn_size((col)->type))
+#define jcolumn_valid(col, row) \
+  ((col)->valid[(row) / 64] |= 1ull << (row) % 64)
+
+static int jcolumn_check(const jcolumn_t* cols, int ncols) {
+  if (ncols < 0) {
+    jerror_log(JERR_ARG, "Negative column count %d.", ncols);
+    return 0;
+  }
+  for (int i = 0; i < ncols; i++) {
+    const jcolumn_t* col = cols + i;
+    if (!col->key) {
+      jerror_log(JERR_ARG, "Null key of column %d.", i);
+    } else if (col->type < JCOLUMN_DOUBLE || col->type > JCOLUMN_STRING) {
+      jerror_log(JERR_ARG, "Invalid type of column '%s'.", col->key);
+    } else if (!col->cells) {
+      jerror_log(JERR_ARG, "Column '%s' has no cells.", col->key);
+    } else {
+      continue;
+    }
     return 0;
   }
+  return 1;
 }
 
-int jarray_remove(jnode_t* jnode, int index) {
-  jerror_clear();
-  check_type(jnode, array, 0);
-  jarray_t* jarr = jas_array(jnode);
-  jnode_t** item = jvector_remove(jnode_t*, &jarr->array, index, 1);
-  if (item) {
-    jdelete(*item);
+/* Store `value`, 0 when missing, in row `row` of `col`. `index` is the
+ * position of the row in the array. */
+static int jcolumn_store(const jcolumn_t* col, int row, int index,
+                         jnode_t* value) {
+  char* cell = jcolumn_cell(col, row);
+  if (!value || jis_null(value)) {
+    memset(cell, 0, jcolumn_size(col->type));
+    return 1;
+  }
+  int ok = 0;
+  switch (col->type) {
+    case JCOLUMN_DOUBLE: {
+      if ((ok = jis_number(value))) *(double*)cell = jas_number(value)->value;
+      break;
+    }
+    case JCOLUMN_INT64: {
+      if ((ok = jis_number(value) && jis_int64(jas_number(value)->value)))
+        *(int64_t*)cell = (int64_t)jas_number(value)->value;
+      break;
+    }
+    case JCOLUMN_STRING: {
+      if (!(ok = jis_string(value))) break;
+      jstring_t* jstr = jas_string(value);
+      *(jstrview_t*)cell = (jstrview_t){.data = jvector_data(jstr->string),
+                                        .len = jvector_len(jstr->string)};
+      break;
+    }
+  }
+  if (ok) {
+    if (col->valid) jcolumn_valid(col, row);
     return 1;
-  } else {
-    return 0;
   }
+  jerror_log(JERR_TYPE, "Expect %s for '%s' at row %d but got type '%s'",
+             jcolumn_type_str[col->type], col->key, index,
+             type_str[jtype(value)]);
+  return 0;
 }
 
-void jarray_foreach(jnode_t* jnode, void (*f)(jnode_t*)) {
+#define JCOLUMN_BATCH 16
+
+/* Look up a batch of keys in a batch of rows, in passes over the whole
+ * batch like jobject_probe() does for one object, so the cache misses of
+ * every row overlap. Elements which are not objects get no values. */
+static void jcolumn_probe(jnode_t** items, int m, const jkey_t* keys, int n,
+                          jnode_t* (*values)[JOBJECT_PROBE_BATCH]) {
+  jkv_t* heads[JCOLUMN_BATCH][JOBJECT_PROBE_BATCH];
+  for (int r = 0; r < m; r++) __builtin_prefetch(items[r]);
+  for (int r = 0; r < m; r++) {
+    if (!jis_object(items[r])) continue;
+    jobject_t* jobj = jas_object(items[r]);
+    int capacity = jht_capacity(jobj->hashmap);
+    for (int i = 0; i < n; i++) {
+      heads[r][i] = jht_get(jobj->hashmap, keys[i].hash % capacity);
+      __builtin_prefetch(heads[r][i]);
+    }
+  }
+  for (int r = 0; r < m; r++) {
+    if (!jis_object(items[r])) continue;
+    for (int i = 0; i < n; i++) {
+      heads[r][i] = heads[r][i]->next;
+      if (heads[r][i]) __builtin_prefetch(heads[r][i]);
+    }
+  }
+  for (int r = 0; r < m; r++) {
+    for (int i = 0; i < n; i++) {
+      jkv_t* it = jis_object(items[r]) ? heads[r][i] : 0;
+      while (it && strcmp(keys[i].key, it->key)) it = it->next;
+      values[r][i] = it ? it->value : 0;
+      if (it) __builtin_prefetch(it->value);
+    }
+  }
+}
+
+int jcolumns_extract(jnode_t* jnode, int first, const jcolumn_t* cols,
+                     int ncols, int cap) {
   jerror_clear();
-  check_type(jnode, array, );
+  check_type(jnode, array, -1);
+  if (!jcolumn_check(cols, ncols)) return -1;
   jarray_t* jarr = jas_array(jnode);
-  jvector_foreach(i, jarr->array) {
-    jnode_t* item = *jvector_get(jarr->array, i);
-    f(item);
+  int size = jvector_len(jarr->array);
+  if (first < 0 || first > size) {
+    jerror_log(JERR_INDEX, "Invalid index '%d'.", first);
+    return -1;
   }
+  if (cap < 0) {
+    jerror_log(JERR_ARG, "Negative row count %d.", cap);
+    return -1;
+  }
+
+  int rows = size - first < cap ? size - first : cap;
+  jnode_t** items = jvector_data(jarr->array) + first;
+  for (int i = 0; i < ncols; i++) {
+    if (cols[i].valid)
+      memset(cols[i].valid, 0, (rows + 63) / 64 * sizeof(uint64_t));
+  }
+  // a batch of columns at a time, their keys hashed once for all rows
+  for (int base = 0; base < ncols; base += JOBJECT_PROBE_BATCH) {
+    jkey_t keys[JOBJECT_PROBE_BATCH];
+    jnode_t* values[JCOLUMN_BATCH][JOBJECT_PROBE_BATCH];
+    int n = ncols - base < JOBJECT_PROBE_BATCH ? ncols - base
+                                               : JOBJECT_PROBE_BATCH;
+    for (int i = 0; i < n; i++) jkey_init(keys + i, cols[base + i].key);
+    for (int row = 0; row < rows; row += JCOLUMN_BATCH) {
+      int m = rows - row < JCOLUMN_BATCH ? rows - row : JCOLUMN_BATCH;
+      jcolumn_probe(items + row, m, keys, n, values);
+      for (int r = 0; r < m; r++) {
+        jnode_t* item = items[row + r];
+        if (!jis_object(item) && !jis_null(item)) {
+          jerror_log(JERR_TYPE, "Expect an object at row %d but got type '%s'",
+                     first + row + r, type_str[jtype(item)]);
+          return -1;
+        }
+        for (int i = 0; i < n; i++) {
+          const jcolumn_t* col = cols + base + i;
+          if (!jcolumn_store(col, row + r, first + row + r, values[r][i]))
+            return -1;
+        }
+      }
+    }
+  }
+  return rows;
 }
 
-/* ==============================
- *      5. OBJECT OPERATION
- * ============================== */
+typedef struct jcolumn_slot {
+  jcolumn_t col;
+  int len;    // of the key
+  int row;    // row of the batch last given a value, -1 for none
+  int fixup;  // entry in `fixups` for that value, -1 for none
+} jcolumn_slot_t;
+
+/* A string cell whose unescaped bytes are in `strings`, which may still
+ * move until the batch is complete. */
+typedef struct jcolumn_fixup {
+  int slot;  // -1 once the cell is given another value
+  int row;
+  int offset;
+} jcolumn_fixup_t;
+
+enum jcolumns_state {
+  JCOLUMNS_START = 0,
+  JCOLUMNS_ROWS,  // inside the array, before an element
+  JCOLUMNS_END,
+  JCOLUMNS_FAILED,
+};
 
-int jobject_size(jnode_t* jnode) {
+struct jcolumns {
+  jparser_t parser;
+  int state;  // JCOLUMNS_*
+  int rows;   // read by the batches before the current one
+  int hint;   // slot after the one matched last
+  jcolumn_slot_t* slots;
+  int nslots;
+  jvector(jcolumn_fixup_t, fixups);
+  jvector(char, strings);  // unescaped strings of the current batch
+};
+
+jcolumns_t* jcolumns_open(const char* buf, size_t len, const jcolumn_t* cols,
+                          int ncols, const jparse_opts_t* opts) {
   jerror_clear();
-  check_type(jnode, object, 0);
-  jobject_t* jobj = jas_object(jnode);
-  return jht_size(jobj->hashmap);
+  if (!jcolumn_check(cols, ncols)) return 0;
+  for (int i = 0; i < ncols; i++) {
+    for (int j = 0; j < i; j++) {
+      if (strcmp(cols[i].key, cols[j].key)) continue;
+      jerror_log(JERR_ARG, "Duplicate column '%s'.", cols[i].key);
+      return 0;
+    }
+  }
+
+  jcolumns_t* reader = reallocate(0, 0, sizeof(*reader));
+  jcolumn_slot_t* slots = reallocate(0, 0, (ncols ? ncols : 1) *
+                                               sizeof(jcolumn_slot_t));
+  if (!reader || !slots) {
+    reallocate(reader, 0, 0);
+    reallocate(slots, 0, 0);
+    return 0;
+  }
+  *reader = (jcolumns_t){.slots = slots, .nslots = ncols};
+  for (int i = 0; i < ncols; i++)
+    slots[i] = (jcolumn_slot_t){.col = cols[i], .len = strlen(cols[i].key)};
+  jparser_init(&reader->parser, buf, 0, len, opts);
+  jvector_init(jcolumn_fixup_t, &reader->fixups);
+  jvector_init(char, &reader->strings);
+  return reader;
 }
 
-int jobject_has(jnode_t* jnode, const char* key) {
-  jerror_clear();
-  check_type(jnode, object, 0);
-  jobject_t* jobj = jas_object(jnode);
-  jkv_t* head = jht_head(jobj->hashmap, key);
+/* Slot reading the key [key, key + len), 0 if none. Rows of one array
+ * mostly list their keys in the same order, so the search starts after
+ * the slot matched last and usually ends there. */
+static jcolumn_slot_t* jcolumns_find(jcolumns_t* reader, const char* key,
+                                     int len) {
+  for (int i = 0, at = reader->hint; i < reader->nslots; i++, at++) {
+    if (at == reader->nslots) at = 0;
+    jcolumn_slot_t* slot = reader->slots + at;
+    if (slot->len != len || memcmp(slot->col.key, key, len)) continue;
+    reader->hint = at + 1;
+    return slot;
+  }
+  return 0;
+}
 
-  int found = 0, len = 0;
-  for (const jkv_t* it = head->next; it; it = it->next) {
-    len++;
-    if (!strcmp(key, it->key)) {
-      found = 0;
+static int jcolumns_value(jcolumns_t* reader, jcolumn_slot_t* slot,
+                          int row) {
+  jparser_t* parser = &reader->parser;
+  const jtoken_t* tk = jparser_currptr(parser);
+  const jcolumn_t* col = &slot->col;
+  char* cell = jcolumn_cell(col, row);
+  // a repeated key replaces the earlier value
+  if (slot->row == row && slot->fixup >= 0)
+    reader->fixups.data[slot->fixup].slot = -1;
+  slot->row = row;
+  slot->fixup = -1;
+  if (tk->type == JTK_NULL) {
+    memset(cell, 0, jcolumn_size(col->type));
+    if (col->valid) col->valid[row / 64] &= ~(1ull << row % 64);
+    return jparser_advance(parser);
+  }
+
+  int ok = 0;
+  switch (col->type) {
+    case JCOLUMN_DOUBLE: {
+      if ((ok = tk->type == JTK_NUMBER))
+        *(double*)cell = jnumber_parse(tk->lexeme, tk->len);
+      break;
+    }
+    case JCOLUMN_INT64: {
+      ok = tk->type == JTK_NUMBER &&
+           jbind_integer(tk, INT64_MIN, INT64_MAX, (int64_t*)cell);
+      break;
+    }
+    case JCOLUMN_STRING: {
+      if (!(ok = tk->type == JTK_STRING)) break;
+      const char* body = tk->as.string;
+      int len = tk->len - 2;
+      if (!memchr(body, '\\', len)) {
+        *(jstrview_t*)cell = (jstrview_t){.data = body, .len = len};
+        break;
+      }
+      jcolumn_fixup_t fixup = {.slot = slot - reader->slots,
+                               .row = row,
+                               .offset = reader->strings.len};
+      if (!junescape(body, body + len, jas_tv(&reader->strings)) ||
+          !jvector_concat(jcolumn_fixup_t, &reader->fixups, &fixup, 1))
+        return 0;
+      slot->fixup = reader->fixups.len - 1;
+      *(jstrview_t*)cell = (jstrview_t){
+          .data = 0, .len = reader->strings.len - fixup.offset};
       break;
     }
   }
+  if (!ok) {
+    int rest = tk->len < 16 ? tk->len : 16;
+    jlexer_error(&parser->lexer, JERR_TYPE,
+                 jtoken_offset(&parser->lexer, tk),
+                 "Expect %s for '%s' but got '%.*s'",
+                 jcolumn_type_str[col->type], col->key, rest, tk->lexeme);
+    return 0;
+  }
+  if (col->valid) jcolumn_valid(col, row);
+  return jparser_advance(parser);
+}
 
-  // remap if load is too high
-  if (len > jht_max_len) {
-    jht_grow(jas_tv(&jobj->hashmap));
+static int jcolumns_object(jcolumns_t* reader, int row) {
+  jparser_t* parser = &reader->parser;
+  if (!jbind_open(parser, 2)) return 0;
+  if (jparser_match(parser, '}')) return jparser_advance(parser);
+  for (;;) {
+    const char* key;
+    int len;
+    if (!jbind_key(parser, &key, &len)) return 0;
+    jcolumn_slot_t* slot = jcolumns_find(reader, key, len);
+    if (slot) {
+      if (!jcolumns_value(reader, slot, row)) return 0;
+    } else if (!jbind_skip(parser)) {
+      return 0;
+    }
+
+    if (jparser_match(parser, '}')) return jparser_advance(parser);
+    if (!jparser_match(parser, ',')) {
+      jparser_expect(parser, "',' or '}'");
+      return 0;
+    }
+    if (!jparser_advance(parser)) return 0;
   }
+}
 
-  return found;
+/* Read the element at the current token into row `row` of the batch. */
+static int jcolumns_row(jcolumns_t* reader, int row) {
+  jparser_t* parser = &reader->parser;
+  const jtoken_t* tk = jparser_currptr(parser);
+  for (int i = 0; row % 64 == 0 && i < reader->nslots; i++) {
+    if (reader->slots[i].col.valid) reader->slots[i].col.valid[row / 64] = 0;
+  }
+
+  if (tk->type == '{') {
+    if (!jcolumns_object(reader, row)) return 0;
+  } else if (tk->type == JTK_NULL) {
+    if (!jparser_advance(parser)) return 0;
+  } else if (tk->type == '[' ||
+             (tk->type > JTK_NULL && tk->type <= JTK_STRING)) {
+    int rest = tk->len < 16 ? tk->len : 16;
+    jlexer_error(&parser->lexer, JERR_TYPE,
+                 jtoken_offset(&parser->lexer, tk),
+                 "Expect an object at row %d but got '%.*s'",
+                 reader->rows + row, rest, tk->lexeme);
+    return 0;
+  } else {
+    jparser_expect(parser, "a value");
+    return 0;
+  }
+
+  // cells of the keys the element does not have
+  for (int i = 0; i < reader->nslots; i++) {
+    jcolumn_slot_t* slot = reader->slots + i;
+    if (slot->row != row)
+      memset(jcolumn_cell(&slot->col, row), 0, jcolumn_size(slot->col.type));
+  }
+  return 1;
 }
 
-jnode_t* jobject_get(jnode_t* jnode, const char* key) {
+/* Past the closing bracket of the array, nothing may follow. */
+static int jcolumns_end(jcolumns_t* reader) {
+  jparser_t* parser = &reader->parser;
+  if (!jparser_advance(parser)) return 0;
+  if (!jparser_is_end(parser)) {
+    jparser_expect(parser, "end of input");
+    return 0;
+  }
+  reader->state = JCOLUMNS_END;
+  return 1;
+}
+
+static int jcolumns_batch(jcolumns_t* reader, int cap, int* rows) {
+  jparser_t* parser = &reader->parser;
+  reader->fixups.len = 0;
+  reader->strings.len = 0;
+  for (int i = 0; i < reader->nslots; i++) {
+    reader->slots[i].row = -1;
+    reader->slots[i].fixup = -1;
+  }
+  if (reader->state == JCOLUMNS_START) {
+    if (!jparser_advance(parser)) return 0;
+    if (!jparser_match(parser, '[')) {
+      jparser_expect(parser, "an array");
+      return 0;
+    }
+    if (!jbind_open(parser, 1)) return 0;
+    reader->state = JCOLUMNS_ROWS;
+    if (jparser_match(parser, ']') && !jcolumns_end(reader)) return 0;
+  }
+
+  while (reader->state == JCOLUMNS_ROWS && *rows < cap) {
+    if (!jcolumns_row(reader, *rows)) return 0;
+    ++*rows;
+    if (jparser_match(parser, ']')) {
+      if (!jcolumns_end(reader)) return 0;
+    } else if (!jparser_match(parser, ',')) {
+      jparser_expect(parser, "',' or ']'");
+      return 0;
+    } else if (!jparser_advance(parser)) {
+      return 0;
+    }
+  }
+
+  // the strings are in their final place now
+  for (int i = 0; i < reader->fixups.len; i++) {
+    const jcolumn_fixup_t* fixup = reader->fixups.data + i;
+    if (fixup->slot < 0) continue;
+    const jcolumn_t* col = &reader->slots[fixup->slot].col;
+    jstrview_t* view = (jstrview_t*)jcolumn_cell(col, fixup->row);
+    view->data = reader->strings.data + fixup->offset;
+  }
+  reader->rows += *rows;
+  return 1;
+}
+
+int jcolumns_next(jcolumns_t* reader, int cap, jerr_t* err) {
   jerror_clear();
-  check_type(jnode, object, 0);
-  jobject_t* jobj = jas_object(jnode);
-  jkv_t* head = jht_head(jobj->hashmap, key);
+  int rows = 0, ok = 0;
+  if (cap <= 0) {
+    jerror_log(JERR_ARG, "Invalid row count %d.", cap);
+  } else if (reader->state == JCOLUMNS_FAILED) {
+    jerror_log(JERR_ARG, "Reader stopped at an earlier error.");
+  } else if (!(ok = jcolumns_batch(reader, cap, &rows))) {
+    reader->state = JCOLUMNS_FAILED;
+  }
+  if (err) {
+    if (ok) err->code = JERR_NONE;
+    else *err = jerr_last;
+  }
+  return ok ? rows : -1;
+}
 
-  int len = 0;
-  const jkv_t* found = 0;
-  for (const jkv_t* it = head->next; it; it = it->next) {
-    len++;
-    if (!strcmp(key, it->key)) {
-      found = it;
+void jcolumns_close(jcolumns_t* reader) {
+  if (!reader) return;
+  jparser_free(&reader->parser);
+  jvector_free(jcolumn_fixup_t, &reader->fixups);
+  jvector_free(char, &reader->strings);
+  reallocate(reader->slots, 0, 0);
+  reallocate(reader, 0, 0);
+}
+
+/* ==============================
+ *          11. PATCH
+ * ============================== */
+
+/* Drop the null members of every object in a merge patch value, so it can
+ * be moved into a target as it is. Arrays are plain values and kept whole.
+ * Runs before the walk enters the object, which then sees only what is
+ * left. */
+static int jmerge_prune_pre(const jvisit_t* visit, void* ctx) {
+  (void)ctx;
+  if (!jis_object(visit->node)) return JWALK_SKIP;
+  jobject_t* jobj = jas_object(visit->node);
+  int size = jht_size(jobj->hashmap);
+  for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
+    jkv_t* prev = jht_get(jobj->hashmap, i);
+    while (prev->next) {
+      jkv_t* kv = prev->next;
+      if (!jis_null(kv->value)) {
+        prev = kv;
+        continue;
+      }
+      prev->next = kv->next;
+      reallocate(kv->key, 0, 0);
+      reallocate(kv, sizeof(jkv_t), 0);
+      jht_size(jobj->hashmap)--;
+    }
+  }
+  if (jht_size(jobj->hashmap) != size) jnode_touch(visit->node);
+  return JWALK_CONTINUE;
+}
+
+#define jmerge_prune(patch) jwalk_ex((patch), jmerge_prune_pre, 0, 0, 0)
+
+typedef struct jmerge_ctx {
+  jnode_t* target;
+  jvector(jnode_t*, opened);  // target objects of the open patch objects
+} jmerge_ctx_t;
+
+/* RFC 7386 while walking the patch. A patch object meeting a target object
+ * is entered, any other value moved into the target, which leaves the
+ * patch holding nulls. */
+static int jmerge_pre(const jvisit_t* visit, void* ctx) {
+  jmerge_ctx_t* mc = ctx;
+  jnode_t* target = mc->target;
+  if (visit->parent) {
+    jnode_t* parent = *jvector_get(mc->opened, visit->depth - 1);
+    jnode_t* value = visit->node;
+    unsigned int hash = fnv1a(visit->key);
+    jkv_t* old = jobject_find(jas_object(parent), visit->key, hash);
+    if (jis_null(value)) {
+      if (old) jobject_put(parent, visit->key, 0);
+      return JWALK_SKIP;
+    }
+    if (!jis_object(value) || !old || !jis_object(old->value)) {
+      if (jis_object(value) && !jmerge_prune(value)) return JWALK_ABORT;
+      jkv_t* kv = jobject_find(jas_object(visit->parent), visit->key, hash);
+      kv->value = jnull_new();
+      if (jis_linked(value)) jas_linked(value)->parent = 0;
+      if (!jobject_put(parent, visit->key, value)) {
+        kv->value = value;
+        if (jis_linked(value)) jas_linked(value)->parent = visit->parent;
+        return JWALK_ABORT;
+      }
+      return JWALK_SKIP;
     }
+    target = old->value;
   }
+  mc->opened.len = visit->depth;
+  if (!jvector_concat(jnode_t*, &mc->opened, &target, 1)) return JWALK_ABORT;
+  return JWALK_CONTINUE;
+}
 
-  if (!found) {
-    jerror_log("Key '%s' not exists.", key);
+int jmerge_patch(jnode_t** target, jnode_t* patch) {
+  jerror_clear();
+  if (jis_linked(*target) && jas_linked(*target)->parent) {
+    jerror_log(JERR_ARG, "Target is not a root.");
+    jdelete(patch);
     return 0;
   }
+  if (!jis_object(patch) || !jis_object(*target)) {
+    if (jis_object(patch) && !jmerge_prune(patch)) {
+      jerror_keep(jdelete(patch));
+      return 0;
+    }
+    jdelete(*target);
+    *target = patch;
+    return 1;
+  }
+  jmerge_ctx_t ctx = {.target = *target};
+  jvector_init(jnode_t*, &ctx.opened);
+  int ok = jwalk_ex(patch, jmerge_pre, 0, &ctx, 0);
+  jvector_free(jnode_t*, &ctx.opened);
+  jerror_keep(jdelete(patch));
+  return ok;
+}
 
-  // remap if load is too high
-  if (len > jht_max_len) {
-    jht_grow(jas_tv(&jobj->hashmap));
+enum jpatch_kind {
+  JPATCH_ADD = 0,
+  JPATCH_REMOVE,
+  JPATCH_REPLACE,
+  JPATCH_MOVE,
+  JPATCH_COPY,
+  JPATCH_TEST,
+};
+
+static const char* jpatch_kind_str[] = {"add",  "remove", "replace",
+                                        "move", "copy",   "test"};
+
+typedef struct jpatch_op {
+  int kind;        // JPATCH_*
+  jpath_t* path;
+  jpath_t* from;   // move and copy only
+  jnode_t* value;  // add, replace and test only
+} jpatch_op_t;
+
+struct jpatch {
+  jvector(jpatch_op_t, ops);
+};
+
+void jpatch_free(jpatch_t* patch) {
+  if (!patch) return;
+  for (int i = 0; i < jvector_len(patch->ops); i++) {
+    jpatch_op_t* op = jvector_get(patch->ops, i);
+    jpath_free(op->path);
+    jpath_free(op->from);
+    jdelete(op->value);
   }
+  jvector_free(jpatch_op_t, &patch->ops);
+  reallocate(patch, sizeof(jpatch_t), 0);
+}
 
-  return found->value;
+/* Member `key` of operation `index`, 0 when it is missing. `type` is a
+ * jtype_t, or -1 for any type. */
+static jnode_t* jpatch_member(jnode_t* node, const char* key, int type,
+                              int index) {
+  jkv_t* kv = jobject_find(jas_object(node), key, fnv1a(key));
+  if (kv && (type < 0 || (int)jtype(kv->value) == type)) return kv->value;
+  if (type < 0) {
+    jerror_log(JERR_KEY, "Operation %d has no '%s'.", index, key);
+  } else {
+    jerror_log(JERR_TYPE, "Expect %s '%s' in operation %d.", type_str[type],
+               key, index);
+  }
+  return 0;
 }
 
-int jobject_put(jnode_t* jnode, const char* key, jnode_t* value) {
-  jerror_clear();
-  if (!key) {
-    jerror_log("Null key.");
+static int jpatch_compile_op(jnode_t* node, int index, jpatch_op_t* op) {
+  if (!jis_object(node)) {
+    jerror_log(JERR_TYPE, "Expect object for operation %d but got type '%s'",
+               index, type_str[jtype(node)]);
+    return 0;
+  }
+  jnode_t* name = jpatch_member(node, "op", JSTRING, index);
+  if (!name) return 0;
+  const char* kind = jvector_data(jas_string(name)->string);
+  for (op->kind = JPATCH_ADD; op->kind <= JPATCH_TEST; op->kind++) {
+    if (!strcmp(kind, jpatch_kind_str[op->kind])) break;
+  }
+  if (op->kind > JPATCH_TEST) {
+    jerror_log(JERR_ARG, "Unknown operation '%s' at %d.", kind, index);
     return 0;
   }
 
-  check_type(jnode, object, 0);
-  jobject_t* jobj = jas_object(jnode);
-  int hash = fnv1a(key);
-  jkv_t* head = jht_head(jobj->hashmap, key);
+  jnode_t* path = jpatch_member(node, "path", JSTRING, index);
+  if (!path ||
+      !(op->path = jpointer_compile(jvector_data(jas_string(path)->string))))
+    return 0;
+  if (op->kind == JPATCH_MOVE || op->kind == JPATCH_COPY) {
+    jnode_t* from = jpatch_member(node, "from", JSTRING, index);
+    if (!from ||
+        !(op->from = jpointer_compile(jvector_data(jas_string(from)->string))))
+      return 0;
+  }
+  if (op->kind == JPATCH_ADD || op->kind == JPATCH_REPLACE ||
+      op->kind == JPATCH_TEST) {
+    jnode_t* value = jpatch_member(node, "value", -1, index);
+    if (!value || !(op->value = jclone(value))) return 0;
+  }
+  return 1;
+}
 
-  int len = 0;
-  jkv_t *target = 0, *prev = head;
-  for (jkv_t* it = head->next; it; prev = it, it = it->next) {
-    len++;
-    if (!strcmp(key, it->key)) {
-      target = it;
-      break;
+jpatch_t* jpatch_compile(jnode_t* ops) {
+  jerror_clear();
+  check_type(ops, array, 0);
+  jpatch_t* patch = reallocate(0, 0, sizeof(jpatch_t));
+  if (!patch) return 0;
+  jvector_init(jpatch_op_t, &patch->ops);
+  int len = jvector_len(jas_array(ops)->array);
+  if (!jvector_reserve(jpatch_op_t, &patch->ops, len ? len : 1)) {
+    jerror_keep(jpatch_free(patch));
+    return 0;
+  }
+  for (int i = 0; i < len; i++) {
+    jpatch_op_t* op = jvector_get(patch->ops, i);
+    *op = (jpatch_op_t){0};
+    patch->ops.len++;  // owned by the patch from here on
+    if (!jpatch_compile_op(*jvector_get(jas_array(ops)->array, i), i, op)) {
+      jerror_keep(jpatch_free(patch));
+      return 0;
     }
   }
+  return patch;
+}
 
-  int changed = 0;
-  if (target) {
-    if (value) {
-      // update
-      jnode_t* old = target->value;
-      target->value = value;
-      jdelete(old);
-      changed = 1;
-    } else {
-      // erase
-      prev->next = target->next;
-      jdelete(target->value);
-      reallocate(target->key, 0, 0);
-      reallocate(target, sizeof(jkv_t), 0);
+/* Parent of the node named by `path`, 0 when the way there is missing.
+ * Only the last step is left to the caller. */
+static jnode_t* jpatch_parent(jnode_t* root, const jpath_t* path) {
+  jnode_t* node = root;
+  for (int i = 0; i + 1 < jvector_len(path->steps); i++) {
+    const jstep_t* step = jvector_get(path->steps, i);
+    jnode_t* child = jpath_child(node, step);
+    if (!child) {
+      jpath_miss(node, step);
+      return 0;
+    }
+    node = child;
+  }
+  return node;
+}
+
+/* Position named by `step` in an array. Up to the length for an insert,
+ * where "-" names the end, below it otherwise. -1 when invalid. */
+static int jpatch_index(jnode_t* array, const jstep_t* step, int insert) {
+  int len = jvector_len(jas_array(array)->array);
+  int index = insert && !strcmp(step->key, "-") ? len : step->index;
+  if (index >= 0 && (index < len || (insert && index == len))) return index;
+  jerror_log(JERR_INDEX, "Invalid index '%s'.", step->key);
+  return -1;
+}
+
+/* Put `value` at `index` of an array, which may be its end. */
+static int jpatch_insert(jnode_t* array, int index, jnode_t* value) {
+  if (index == jvector_len(jas_array(array)->array))
+    return jarray_add(array, value);  // inserting rejects the end
+  return jarray_insert(array, index, value);
+}
+
+/* Put `value` where `path` points, replacing an object member or the root
+ * and shifting array elements. On failure the tree is left as it was and
+ * `value` stays with the caller. */
+static int jpatch_add(jnode_t** root, const jpath_t* path, jnode_t* value) {
+  int n = jvector_len(path->steps);
+  if (!n) {
+    jdelete(*root);
+    *root = value;
+    return 1;
+  }
+  const jstep_t* last = jvector_get(path->steps, n - 1);
+  jnode_t* parent = jpatch_parent(*root, path);
+  if (!parent) return 0;
+  if (jis_object(parent)) return jobject_put(parent, last->key, value);
+  if (jis_array(parent)) {
+    int index = jpatch_index(parent, last, 1);
+    return index >= 0 && jpatch_insert(parent, index, value);
+  }
+  jpath_miss(parent, last);
+  return 0;
+}
+
+/* Swap the node `path` points to for `value` in a single step, with the
+ * same guarantees as jpatch_add(). */
+static int jpatch_replace(jnode_t** root, const jpath_t* path,
+                          jnode_t* value) {
+  int n = jvector_len(path->steps);
+  if (!n) return jpatch_add(root, path, value);
+  const jstep_t* last = jvector_get(path->steps, n - 1);
+  jnode_t* parent = jpatch_parent(*root, path);
+  if (!parent) return 0;
+  if (jis_object(parent)) {
+    if (jobject_find(jas_object(parent), last->key, last->hash))
+      return jobject_put(parent, last->key, value);
+  } else if (jis_array(parent)) {
+    int index = jpatch_index(parent, last, 0);
+    return index >= 0 && jarray_splice(parent, index, 1, &value, 1);
+  }
+  jpath_miss(parent, last);
+  return 0;
+}
+
+/* Detach the node `path` points to without deleting it. Where it was is
+ * left in `parent` and, for an array, `index`, see jpatch_restore(). */
+static jnode_t* jpatch_take(jnode_t* root, const jpath_t* path,
+                            jnode_t** parent, int* index) {
+  int n = jvector_len(path->steps);
+  if (!n) {
+    jerror_log(JERR_ARG, "Cannot remove the root.");
+    return 0;
+  }
+  const jstep_t* last = jvector_get(path->steps, n - 1);
+  *parent = jpatch_parent(root, path);
+  if (!*parent) return 0;
+
+  jnode_t* value = 0;
+  if (jis_object(*parent)) {
+    jkv_t* kv = jobject_find(jas_object(*parent), last->key, last->hash);
+    if (kv) {
+      value = kv->value;
+      kv->value = jnull_new();  // deleting a singleton frees nothing
+      jobject_put(*parent, last->key, 0);
+    }
+  } else if (jis_array(*parent)) {
+    *index = jpatch_index(*parent, last, 0);
+    if (*index < 0) return 0;
+    jnode_t** slot = jvector_get(jas_array(*parent)->array, *index);
+    value = *slot;
+    *slot = jnull_new();
+    jarray_remove(*parent, *index);
+  }
+  if (!value) {
+    jpath_miss(*parent, last);
+    return 0;
+  }
+  if (jis_linked(value)) jas_linked(value)->parent = 0;
+  return value;
+}
 
-      jht_size(jobj->hashmap)--;
-      changed = 1;
+/* Put back a node taken from `path`, keeping the error which made it
+ * necessary. The node is deleted if even this fails. */
+static void jpatch_restore(jnode_t* parent, const jpath_t* path, int index,
+                           jnode_t* value) {
+  const jstep_t* last = jvector_get(path->steps, jvector_len(path->steps) - 1);
+  int ok;
+  jerror_keep(ok = jis_object(parent)
+                       ? jobject_put(parent, last->key, value)
+                       : jpatch_insert(parent, index, value));
+  if (!ok) jerror_keep(jdelete(value));
+}
+
+/* Whether the steps of `a` start the steps of `b`. */
+static int jpatch_prefix(const jpath_t* a, const jpath_t* b) {
+  if (jvector_len(a->steps) > jvector_len(b->steps)) return 0;
+  for (int i = 0; i < jvector_len(a->steps); i++) {
+    if (strcmp(jvector_get(a->steps, i)->key, jvector_get(b->steps, i)->key))
+      return 0;
+  }
+  return 1;
+}
+
+/* Run one operation. A failure leaves the tree as it was. */
+static int jpatch_run(jnode_t** root, const jpatch_op_t* op) {
+  jnode_t *value = 0, *parent = 0;
+  int index = 0, ok = 0;
+  switch (op->kind) {
+    case JPATCH_ADD:
+    case JPATCH_REPLACE:
+      if (!(value = jclone(op->value))) return 0;
+      ok = op->kind == JPATCH_ADD ? jpatch_add(root, op->path, value)
+                                  : jpatch_replace(root, op->path, value);
+      break;
+    case JPATCH_COPY: {
+      jnode_t* from = jpath_get(op->from, *root);
+      if (!from || !(value = jclone(from))) return 0;
+      ok = jpatch_add(root, op->path, value);
+      break;
     }
-  } else {
-    if (value) {
-      // add
-      jkv_t* new = reallocate(0, 0, sizeof(jkv_t));
-      if (!new) return 0;
-      new->value = value;
-      int len = strlen(key);
-      new->key = reallocate(0, 0, len + 1);
-      if (!new->key) {
-        reallocate(new, sizeof(jkv_t), 0);
+    case JPATCH_REMOVE:
+      if (!(value = jpatch_take(*root, op->path, &parent, &index))) return 0;
+      jdelete(value);
+      return 1;
+    case JPATCH_MOVE:
+      if (jpatch_prefix(op->from, op->path)) {
+        if (jvector_len(op->from->steps) == jvector_len(op->path->steps))
+          return 1;
+        jerror_log(JERR_ARG, "Cannot move a value into itself.");
         return 0;
       }
-      strcpy(new->key, key);
+      if (!(value = jpatch_take(*root, op->from, &parent, &index))) return 0;
+      if (jpatch_add(root, op->path, value)) return 1;
+      jpatch_restore(parent, op->from, index, value);
+      return 0;
+    case JPATCH_TEST: {
+      jnode_t* node = jpath_get(op->path, *root);
+      if (!node) return 0;
+      if (jequal(node, op->value)) return 1;
+      jerror_log(JERR_TEST, "Test failed.");
+      return 0;
+    }
+  }
+  if (!ok) jerror_keep(jdelete(value));
+  return ok;
+}
 
-      // prepend
-      new->next = head->next;
-      head->next = new;
+int jpatch_apply(jnode_t** target, const jpatch_t* patch) {
+  jerror_clear();
+  if (jis_linked(*target) && jas_linked(*target)->parent) {
+    jerror_log(JERR_ARG, "Target is not a root.");
+    return 0;
+  }
+  for (int i = 0; i < jvector_len(patch->ops); i++) {
+    const jpatch_op_t* op = jvector_get(patch->ops, i);
+    if (jpatch_run(target, op)) continue;
+    // name the operation which failed
+    char msg[SJSON_ERRMSG_LEN];
+    memcpy(msg, jerr_last.msg, sizeof(msg));
+    jerror_log(jerr_last.code, "Operation %d (%s): %.200s", i,
+               jpatch_kind_str[op->kind], msg);
+    return 0;
+  }
+  return 1;
+}
 
-      jht_size(jobj->hashmap)++;
-      changed = 1;
+/* A container of `a` whose counterpart in `b` is being compared. */
+typedef struct jdiff_frame {
+  jnode_t* other;  // counterpart in `b`
+  int mark;        // length of the pointer to both
+  int head;        // arrays: equal leading elements
+  int pairs;       // arrays: elements compared after them
+  int tail;        // arrays: equal trailing elements
+} jdiff_frame_t;
+
+typedef struct jdiff {
+  jnode_t* ops;
+  jnode_t* other;                  // root of `b`
+  jvector(char, path);             // pointer to the current node
+  jvector(jdiff_frame_t, frames);  // open containers by depth
+} jdiff_t;
+
+/* Point the path at member `key`, or at element `index` when `key` is 0,
+ * of the container whose pointer is `mark` bytes long. */
+static int jdiff_point(jdiff_t* diff, int mark, const char* key, int index) {
+  tv* path = jas_tv(&diff->path);
+  char buffer[16];
+  if (!key) {
+    sprintf(buffer, "%d", index);
+    key = buffer;
+  }
+  path->len = mark;
+  int ok = jvector_concat(char, path, "/", 1);
+  for (const char* p = key; ok && *p; p++) {
+    if (*p == '~') ok = jvector_concat(char, path, "~0", 2);
+    else if (*p == '/') ok = jvector_concat(char, path, "~1", 2);
+    else ok = jvector_concat(char, path, p, 1);
+  }
+  return ok && jvector_concat(char, path, "", 1);
+}
+
+/* Append an operation on the current path. `value` is copied. */
+static int jdiff_op(jdiff_t* diff, int kind, jnode_t* value) {
+  jnode_t* op = jobject_new();
+  if (!op) return 0;
+  jnode_t* name = jstring_new(0, jpatch_kind_str[kind]);
+  jnode_t* path = jstring_new(diff->path.len - 1, diff->path.data);
+  int ok = name && jobject_put(op, "op", name);
+  if (!ok) jerror_keep(jdelete(name));
+  ok = ok && path && jobject_put(op, "path", path);
+  if (!ok) jerror_keep(jdelete(path));
+  if (ok && value) {
+    jnode_t* copy = jclone(value);
+    ok = copy && jobject_put(op, "value", copy);
+    if (!ok) jerror_keep(jdelete(copy));
+  }
+  if (ok && jarray_add(diff->ops, op)) return 1;
+  jerror_keep(jdelete(op));
+  return 0;
+}
+
+/* Identical nodes, or containers whose kept hashes match, are taken as
+ * equal without looking inside. */
+#define jdiff_same(a, b)                                   \
+  ((a) == (b) || (jhash_kept(a) && jhash_kept(b) &&        \
+                  jcache_of(a)->hash == jcache_of(b)->hash))
+
+/* Equal leading and trailing elements are skipped, the rest is compared
+ * pairwise and the longer side removed or added at the end, so a single
+ * insertion or deletion gives a single operation. Arrays of one length
+ * give the same operations without skipping, so there only the O(1)
+ * checks are used: jequal() would scan subtrees the walk is about to enter
+ * again, which deep nesting turns quadratic. */
+static void jdiff_trim(jnode_t* a, jnode_t* b, jdiff_frame_t* frame) {
+  jnode_t** x = jvector_data(jas_array(a)->array);
+  jnode_t** y = jvector_data(jas_array(b)->array);
+  int nx = jvector_len(jas_array(a)->array);
+  int ny = jvector_len(jas_array(b)->array);
+  int deep = nx != ny;
+#define jdiff_equal(i, j) \
+  (jdiff_same(x[i], y[j]) || (deep && jequal(x[i], y[j])))
+  int head = 0, tail = 0;
+  while (head < nx && head < ny && jdiff_equal(head, head)) head++;
+  while (tail < nx - head && tail < ny - head &&
+         jdiff_equal(nx - 1 - tail, ny - 1 - tail))
+    tail++;
+#undef jdiff_equal
+  frame->head = head;
+  frame->tail = tail;
+  frame->pairs = nx - head - tail < ny - head - tail ? nx - head - tail
+                                                     : ny - head - tail;
+}
+
+/* Compare `a` with its counterpart `b` at the current path. Containers of
+ * the same type are opened for the walk to enter, anything else is equal
+ * or replaced. */
+static int jdiff_pair(jdiff_t* diff, int depth, jnode_t* a, jnode_t* b) {
+  if (jdiff_same(a, b)) return JWALK_SKIP;
+  int object = jis_object(a) && jis_object(b);
+  int array = jis_array(a) && jis_array(b);
+  if (!object && !array) {
+    if (jequal_node(a, b)) return JWALK_SKIP;  // equal scalars
+    return jdiff_op(diff, JPATCH_REPLACE, b) ? JWALK_SKIP : JWALK_ABORT;
+  }
+  jdiff_frame_t frame = {.other = b, .mark = diff->path.len - 1};
+  if (array) jdiff_trim(a, b, &frame);
+  diff->frames.len = depth;
+  if (!jvector_concat(jdiff_frame_t, &diff->frames, &frame, 1))
+    return JWALK_ABORT;
+  return JWALK_CONTINUE;
+}
+
+/* Walk `a` and find each node's counterpart in `b`. What `b` lacks is
+ * removed here, what `a` lacks is added once its container is done. */
+static int jdiff_pre(const jvisit_t* visit, void* ctx) {
+  jdiff_t* diff = ctx;
+  if (!visit->parent) return jdiff_pair(diff, 0, visit->node, diff->other);
+  const jdiff_frame_t* frame = jvector_get(diff->frames, visit->depth - 1);
+  jnode_t* b = 0;
+  int index = visit->index;
+  if (visit->key) {
+    jkv_t* kv = jobject_find(jas_object(frame->other), visit->key,
+                            fnv1a(visit->key));
+    if (kv) b = kv->value;
+  } else {
+    int nx = jvector_len(jas_array(visit->parent)->array);
+    if (index < frame->head || index >= nx - frame->tail) return JWALK_SKIP;
+    if (index < frame->head + frame->pairs) {
+      b = *jvector_get(jas_array(frame->other)->array, index);
     } else {
-      // do nothing
-      jerror_log("Null key and null value.");
-      changed = 0;
+      index = frame->head + frame->pairs;  // each removal shifts the next in
     }
   }
+  if (!jdiff_point(diff, frame->mark, visit->key, index)) return JWALK_ABORT;
+  if (b) return jdiff_pair(diff, visit->depth, visit->node, b);
+  return jdiff_op(diff, JPATCH_REMOVE, 0) ? JWALK_SKIP : JWALK_ABORT;
+}
 
-  // remap if load is too high
-  if (len > jht_max_len) {
-    jht_grow(jas_tv(&jobj->hashmap));
+static int jdiff_post(const jvisit_t* visit, void* ctx) {
+  jdiff_t* diff = ctx;
+  jdiff_frame_t frame = *jvector_get(diff->frames, visit->depth);
+  if (jis_object(frame.other)) {
+    jobject_t* x = jas_object(visit->node);
+    jobject_t* y = jas_object(frame.other);
+    for (int i = 0; i < jht_capacity(y->hashmap); i++) {
+      for (jkv_t* kv = jht_get(y->hashmap, i)->next; kv; kv = kv->next) {
+        if (jobject_find(x, kv->key, fnv1a(kv->key))) continue;
+        if (!jdiff_point(diff, frame.mark, kv->key, 0) ||
+            !jdiff_op(diff, JPATCH_ADD, kv->value))
+          return JWALK_ABORT;
+      }
+    }
+  } else {
+    jnode_t** y = jvector_data(jas_array(frame.other)->array);
+    int ny = jvector_len(jas_array(frame.other)->array);
+    for (int i = frame.head + frame.pairs; i < ny - frame.tail; i++) {
+      if (!jdiff_point(diff, frame.mark, 0, i) ||
+          !jdiff_op(diff, JPATCH_ADD, y[i]))
+        return JWALK_ABORT;
+    }
   }
-
-  return changed;
+  return JWALK_CONTINUE;
 }
 
-void jobject_foreach(jnode_t* jnode, void (*f)(const char*, jnode_t*)) {
+jnode_t* jdiff(jnode_t* a, jnode_t* b) {
   jerror_clear();
-  check_type(jnode, object, );
-  jobject_t* jobj = jas_object(jnode);
-  for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
-    jkv_t* head = jht_get(jobj->hashmap, i);
-    for (jkv_t* it = head->next; it; it = it->next) {
-      f(it->key, it->value);
-    }
+  // refresh the kept hashes so that unchanged subtrees compare in O(1)
+  if (jcache_of(a) && jcache_of(b)) {
+    jhash(a);
+    jhash(b);
   }
+  jdiff_t diff = {.ops = jarray_new(), .other = b};
+  jvector_init(char, &diff.path);
+  jvector_init(jdiff_frame_t, &diff.frames);
+  int ok = diff.ops && jvector_concat(char, &diff.path, "", 1) &&
+           jwalk_ex(a, jdiff_pre, jdiff_post, &diff, 0);
+  jvector_free(char, &diff.path);
+  jvector_free(jdiff_frame_t, &diff.frames);
+  if (ok) return diff.ops;
+  jerror_keep(jdelete(diff.ops));
+  return 0;
 }
 
-/* ==============================
- *          6. FROM_STRING
- * ============================== */
+#ifndef SJSON_NO_PARALLEL
 
 /* ==============================
- *          6.1 LEXING
+ *         12. NDJSON
  * ============================== */
 
-#define jlexer_linecol_str " at line %d, column %d."
-#define jlexer_linecol(lexer) (lexer)->line, (lexer)->col
-#define jlexer_ptr(lexer, index) ((lexer)->data + (index))
-#define jlexer_currptr(lexer) jlexer_ptr((lexer), (lexer)->curr)
-#define jlexer_look(lexer, offset) \
-  (*jlexer_ptr((lexer), (lexer)->curr + (offset)))
-#define jlexer_peek(lexer) jlexer_look((lexer), 0)
-#define jlexer_match(lexer, c) (jlexer_peek(lexer) == (c))
-#define jlexer_move(lexer, distance)                            \
-  do {                                                          \
-    for (int i = 0; i < (distance); i++) jlexer_advance(lexer); \
-  } while (0)
-#define jlexer_rest(lexer) ((lexer)->len - (lexer)->curr)
-#define jlexer_is_end(lexer) ((lexer)->curr >= (lexer)->len)
-#define jlexer_to_token(lexer, name, type_, len_, ...) \
-  jtoken_t name = {.line = (lexer)->line,              \
-                   .col = (lexer)->col,                \
-                   .type = (type_),                    \
-                   .len = (len_),                      \
-                   .lexeme = jlexer_currptr(lexer),    \
-                   ##__VA_ARGS__}
-
-#define jtoken_linecol_str " at line %d, column %d."
-#define jtoken_linecol(token) (token)->line, (token)->col
-#define jtoken_lenlexeme(token) (token)->len, (token)->lexeme
+#define jndjson_slot(nd, chunk) ((nd)->slots + (chunk) % (nd)->window)
+#define jndjson_blank(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
 
-enum jtktype {
-  JTK_NULL = 256,
-  JTK_TRUE,
-  JTK_FALSE,
-  JTK_NUMBER,
-  JTK_STRING,
-  JTK_EOF,
+enum jslot_state {
+  JSLOT_EMPTY = 0,
+  JSLOT_BUSY,   // being parsed
+  JSLOT_READY,  // parsed, waiting for delivery
+  JSLOT_DONE,   // delivered
 };
 
-typedef struct jtoken {
-  int line;
-  int col;
-  int type;
-  int len;
-  const char* lexeme;
-  union {
-    double number;
-    const char* string;
-  } as;
-} jtoken_t;
+/* Documents of one chunk. Chunk `i` lives in slot `i % window`. */
+typedef struct jndjson_slot {
+  int state;
+  size_t chunk;
+  jvector(jnode_t*, docs);
+  int failed;
+  jerr_t err;  // offset is absolute in the input
+} jndjson_slot_t;
+
+typedef struct jndjson {
+  const char* buf;
+  size_t len;
+  size_t chunk_size;
+  size_t nchunks;
+  const jparse_opts_t* parse;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int window;  // chunks parsed ahead of delivery, bounds memory
+  jndjson_slot_t* slots;
+  size_t next;  // next chunk to parse
+  size_t low;   // first chunk not delivered yet
+  int stop;
+} jndjson_t;
+
+/* Chunks are cut at fixed offsets and moved forward past the next newline,
+ * so each worker finds its own boundaries without a sequential pre-pass. */
+static size_t jndjson_chunk_start(const jndjson_t* nd, size_t chunk) {
+  size_t pos = chunk * nd->chunk_size;
+  if (!chunk) return 0;
+  if (pos >= nd->len) return nd->len;
+  const char* nl = memchr(nd->buf + pos - 1, '\n', nd->len - pos + 1);
+  return nl ? (size_t)(nl - nd->buf) + 1 : nd->len;
+}
 
-typedef struct jlexer {
-  int len;
-  int curr;
-  int line;
-  int col;
-  const char* data;
-} jlexer_t;
+static void jndjson_parse_chunk(jndjson_t* nd, size_t chunk,
+                                jndjson_slot_t* slot) {
+  const char* p = nd->buf + jndjson_chunk_start(nd, chunk);
+  const char* end = nd->buf + jndjson_chunk_start(nd, chunk + 1);
+  jvector_init(jnode_t*, &slot->docs);
+  slot->failed = 0;
+
+  while (p < end) {
+    const char* nl = memchr(p, '\n', end - p);
+    const char* line_end = nl ? nl : end;
+    const char* q = p;
+    while (q < line_end && jndjson_blank(*q)) q++;
+    if (q < line_end) {
+      jerror_clear();
+      jnode_t* doc =
+          jparse_text(nd->buf, p - nd->buf, line_end - nd->buf, nd->parse);
+      if (!doc || !jvector_concat(jnode_t*, &slot->docs, &doc, 1)) {
+        slot->err = *jerror_detail();
+        jdelete(doc);
+        slot->failed = 1;
+        return;
+      }
+    }
+    p = line_end + 1;
+  }
+}
 
-static void jlexer_advance(jlexer_t* lexer) {
-  if (jlexer_match(lexer, '\n')) {
-    lexer->line++;
-    lexer->col = 0;
-  } else {
-    lexer->col++;
+static void* jndjson_worker(void* arg) {
+  jndjson_t* nd = arg;
+  pthread_mutex_lock(&nd->lock);
+  for (;;) {
+    while (!nd->stop && nd->next < nd->nchunks &&
+           nd->next >= nd->low + nd->window)
+      pthread_cond_wait(&nd->cond, &nd->lock);
+    if (nd->stop || nd->next >= nd->nchunks) break;
+
+    size_t chunk = nd->next++;
+    jndjson_slot_t* slot = jndjson_slot(nd, chunk);
+    slot->state = JSLOT_BUSY;
+    slot->chunk = chunk;
+    pthread_mutex_unlock(&nd->lock);
+
+    jndjson_parse_chunk(nd, chunk, slot);
+
+    pthread_mutex_lock(&nd->lock);
+    slot->state = JSLOT_READY;
+    pthread_cond_broadcast(&nd->cond);
   }
-  lexer->curr++;
+  pthread_mutex_unlock(&nd->lock);
+  return 0;
 }
 
-static void jlexer_skip_blank(jlexer_t* lexer) {
-  jerror_clear();
-  while (!jlexer_is_end(lexer) &&
-         (isblank(jlexer_peek(lexer)) || iscntrl(jlexer_peek(lexer))))
-    jlexer_advance(lexer);
+/* Runs on the calling thread, so callbacks never run concurrently. */
+static int jndjson_deliver(jndjson_t* nd, int ordered,
+                           jndjson_callback_t callback, void* ctx,
+                           jerr_t* err) {
+  int ok = 1;
+  pthread_mutex_lock(&nd->lock);
+  while (ok && nd->low < nd->nchunks) {
+    jndjson_slot_t* slot = 0;
+    size_t last = ordered ? nd->low + 1 : nd->next;
+    for (size_t i = nd->low; i < last && !slot; i++) {
+      jndjson_slot_t* s = jndjson_slot(nd, i);
+      if (s->state == JSLOT_READY && s->chunk == i) slot = s;
+    }
+    if (!slot) {
+      pthread_cond_wait(&nd->cond, &nd->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&nd->lock);
+
+    jvector_foreach(i, slot->docs) {
+      jnode_t* doc = *jvector_get(slot->docs, i);
+      if (ok) ok = callback(doc, ctx);
+      else jdelete(doc);
+    }
+    jvector_free(jnode_t*, &slot->docs);
+    if (ok && slot->failed) {
+      *err = slot->err;
+      ok = 0;
+    }
+
+    pthread_mutex_lock(&nd->lock);
+    slot->state = JSLOT_DONE;
+    while (nd->low < nd->nchunks) {
+      jndjson_slot_t* s = jndjson_slot(nd, nd->low);
+      if (s->state != JSLOT_DONE || s->chunk != nd->low) break;
+      s->state = JSLOT_EMPTY;
+      nd->low++;
+    }
+    pthread_cond_broadcast(&nd->cond);
+  }
+  nd->stop = 1;
+  pthread_cond_broadcast(&nd->cond);
+  pthread_mutex_unlock(&nd->lock);
+  return ok;
 }
 
-static int jlex_keyword(jlexer_t* lexer, tv* tokens, int type,
-                        const char* keyword) {
+int jndjson_parse(const char* buf, size_t len, const jndjson_opts_t* opts,
+                  jndjson_callback_t callback, void* ctx) {
   jerror_clear();
-  int len = strlen(keyword);
-  if (jlexer_rest(lexer) < len) {
-    jerror_log("Insufficient input for lexing" jlexer_linecol_str,
-               jlexer_linecol(lexer));
+  int threads = opts && opts->threads > 0 ? opts->threads : jcpu_count();
+  jndjson_t nd = {
+      .buf = buf,
+      .len = len,
+      .chunk_size = opts && opts->chunk_size ? opts->chunk_size
+                                             : SJSON_NDJSON_CHUNK,
+      .parse = opts ? &opts->parse : 0,
+      .window = opts && opts->max_pending > 0 ? opts->max_pending
+                                              : 2 * threads,
+  };
+  nd.nchunks = (len + nd.chunk_size - 1) / nd.chunk_size;
+  if (!nd.nchunks) return 1;
+  if (threads > (int)nd.nchunks) threads = nd.nchunks;
+
+  nd.slots = reallocate(0, 0, nd.window * sizeof(jndjson_slot_t));
+  pthread_t* workers = reallocate(0, 0, threads * sizeof(pthread_t));
+  if (!nd.slots || !workers) {
+    reallocate(nd.slots, 0, 0);
+    reallocate(workers, 0, 0);
     return 0;
   }
-  if (!strncmp(jlexer_currptr(lexer), keyword, len)) {
-    jlexer_to_token(lexer, tk, type, len);
-    if (!jvector_concat(jtoken_t, tokens, &tk, 1)) return 0;
-    jlexer_move(lexer, len);
-    return 1;
+  memset(nd.slots, 0, nd.window * sizeof(jndjson_slot_t));
+  pthread_mutex_init(&nd.lock, 0);
+  pthread_cond_init(&nd.cond, 0);
+
+  int started = 0;
+  while (started < threads &&
+         !pthread_create(&workers[started], 0, jndjson_worker, &nd))
+    started++;
+
+  jerr_t err = {.code = JERR_NONE};
+  int ok = 0;
+  if (started) {
+    ok = jndjson_deliver(&nd, opts && opts->ordered, callback, ctx, &err);
   } else {
-    jerror_log("Expect keyword '%s' but got '%.8s'" jlexer_linecol_str, keyword,
-               jlexer_currptr(lexer), jlexer_linecol(lexer));
-    return 0;
+    err.code = JERR_MEMORY;
+    snprintf(err.msg, sizeof(err.msg), "Failed to start worker threads.");
   }
-}
+  for (int i = 0; i < started; i++) pthread_join(workers[i], 0);
+
+  // parsed but never delivered
+  for (int i = 0; i < nd.window; i++) {
+    jndjson_slot_t* slot = nd.slots + i;
+    if (slot->state != JSLOT_READY) continue;
+    jvector_foreach(j, slot->docs) jdelete(*jvector_get(slot->docs, j));
+    jvector_free(jnode_t*, &slot->docs);
+  }
+  pthread_mutex_destroy(&nd.lock);
+  pthread_cond_destroy(&nd.cond);
+  reallocate(nd.slots, 0, 0);
+  reallocate(workers, 0, 0);
 
-static int jlex_number(jlexer_t* lexer, tv* tokens) {
   jerror_clear();
-  char* end = 0;
-  double val = strtod(jlexer_currptr(lexer), &end);
-  int len = end - jlexer_currptr(lexer);
-  if (!len) {
-    jerror_log("Unknown number format '%.8s'" jlexer_linecol_str,
-               jlexer_currptr(lexer), jlexer_linecol(lexer));
-    return 0;
+  if (err.code == JERR_MEMORY) {
+    jerror_log(JERR_MEMORY, "%s", err.msg);
+  } else if (err.code) {
+    jerror_log(err.code, "Invalid record: %s", err.msg);
+    jerror_locate(err.offset, err.line, err.col);
   }
-
-  jlexer_to_token(lexer, tk, JTK_NUMBER, len, .as.number = val);
-  if (!jvector_concat(jtoken_t, tokens, &tk, 1)) return 0;
-  jlexer_move(lexer, len);
-  return 1;
+  return ok;
 }
 
-static int jlex_string(jlexer_t* lexer, tv* tokens) {
+int jndjson_read(const char* path, const jndjson_opts_t* opts,
+                 jndjson_callback_t callback, void* ctx) {
   jerror_clear();
-  if (!jlexer_match(lexer, '\"')) {
-    jerror_log("Expect \" but got '%c'" jlexer_linecol_str, jlexer_peek(lexer),
-               jlexer_linecol(lexer));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    jerror_log(JERR_IO, "Failed to open '%s'.", path);
     return 0;
   }
-  jlexer_to_token(lexer, tk, JTK_STRING, 0);
-  jlexer_advance(lexer);
-  tk.len++;
-  tk.as.string = jlexer_currptr(lexer);
-  while (!jlexer_is_end(lexer) && !jlexer_match(lexer, '\"') &&
-         !jlexer_match(lexer, '\n')) {
-    tk.len++;
-    jlexer_advance(lexer);
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    jerror_log(JERR_IO, "Failed to stat '%s'.", path);
+    return 0;
   }
-  if (!jlexer_match(lexer, '\"')) {
-    jerror_log("Expect \" but got '%c'" jlexer_linecol_str, jlexer_peek(lexer),
-               jlexer_linecol(lexer));
+  if (!st.st_size) {
+    close(fd);
+    return 1;
+  }
+
+  char* buf = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    jerror_log(JERR_IO, "Failed to map '%s'.", path);
     return 0;
   }
-  jlexer_advance(lexer);
-  tk.len++;
-  return jvector_concat(jtoken_t, tokens, &tk, 1);
+  posix_madvise(buf, st.st_size, POSIX_MADV_SEQUENTIAL);
+  int ok = jndjson_parse(buf, st.st_size, opts, callback, ctx);
+  munmap(buf, st.st_size);
+  return ok;
 }
 
-static int jlex(jlexer_t* lexer, tv* tokens) {
-  jerror_clear();
-  for (jlexer_skip_blank(lexer); !jlexer_is_end(lexer);
-       jlexer_skip_blank(lexer)) {
-    switch (jlexer_peek(lexer)) {
-      case 'n': {
-        if (!jlex_keyword(lexer, tokens, JTK_NULL, "null")) return 0;
-        break;
-      }
-
-      case 't': {
-        if (!jlex_keyword(lexer, tokens, JTK_TRUE, "true")) return 0;
-        break;
-      }
-
-      case 'f': {
-        if (!jlex_keyword(lexer, tokens, JTK_FALSE, "false")) return 0;
-        break;
-      }
+/* ==============================
+ *     13. PARALLEL PARSING
+ * ============================== */
 
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-      case '+':
-      case '-': {
-        if (!jlex_number(lexer, tokens)) return 0;
-        break;
-      }
+/* Whether 8 bytes hold no quote, comma or bracket. '[' and '{' differ only
+ * by bit 0x20, as do ']' and '}'. */
+static inline int jsplit_plain(const char* p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  uint64_t folded = w | jswar_ones * 0x20;
+  return !(jswar_hasbyte(w, '"') | jswar_hasbyte(w, ',') |
+           jswar_hasbyte(folded, '{') | jswar_hasbyte(folded, '}'));
+}
 
-      case '\"': {
-        if (!jlex_string(lexer, tokens)) return 0;
+/* Elements [begin, end) of the top-level array, without the delimiters. */
+typedef struct jsplit_range {
+  size_t begin;
+  size_t end;
+  jvector(jnode_t*, items);
+  int failed;
+} jsplit_range_t;
+
+typedef struct jsplit {
+  const char* buf;
+  jparse_opts_t parse;  // depth limit already lowered by the outer array
+  jsplit_range_t* ranges;
+} jsplit_t;
+
+/* Cut the body of a top-level array after commas at depth 1, each run being
+ * at least `target` bytes. `cuts` receives the offset where every run begins
+ * and, last, the offset just past the closing bracket. Only quotes, brackets
+ * and commas are looked at; elements are checked when they are parsed.
+ * Return 0 when the input is not a single array with balanced brackets. */
+static int jsplit_array(const char* buf, size_t len, size_t target,
+                        tv* cuts) {
+  const char* p = buf;
+  const char* end = buf + len;
+  while (p < end && jis_blank(*p)) p++;
+  if (p == end || *p++ != '[') return 0;
+
+  size_t pos = p - buf;
+  if (!jvector_concat(size_t, cuts, &pos, 1)) return 0;
+  size_t next = pos + target;
+  int depth = 1;
+  while (p < end) {
+    while (end - p >= 8 && jsplit_plain(p)) p += 8;
+    if (p >= end) break;
+
+    const char* bad;
+    switch (*p++) {
+      case '"': {
+        if (!(p = jscan_string(p, end, 0, &bad))) return 0;
+        p++;
         break;
       }
-
       case '[':
+      case '{': depth++; break;
       case ']':
-      case '{':
-      case '}':
-      case ',':
-      case ':': {
-        jlexer_to_token(lexer, tk, jlexer_peek(lexer), 1);
-        if (!jvector_concat(jtoken_t, tokens, &tk, 1)) return 0;
-        jlexer_advance(lexer);
-        break;
+      case '}': {
+        if (--depth) break;
+        if (p[-1] != ']') return 0;
+        pos = p - buf;
+        while (p < end && jis_blank(*p)) p++;
+        return p == end && jvector_concat(size_t, cuts, &pos, 1);
       }
-
-      default: {
-        // Unrecognizable character
-        jerror_log("Unrecognizable character '%c'" jlexer_linecol_str,
-                   jlexer_peek(lexer), jlexer_linecol(lexer));
-        return 0;
+      case ',': {
+        if (depth != 1 || (size_t)(p - buf) < next) break;
+        pos = p - buf;
+        if (!jvector_concat(size_t, cuts, &pos, 1)) return 0;
+        next = pos + target;
+        break;
       }
     }
   }
-  jlexer_to_token(lexer, tk, JTK_EOF, 0);
-  return jvector_concat(jtoken_t, tokens, &tk, 1);
+  return 0;
 }
 
-/* ==============================
- *          6.2 PARSING
- * ============================== */
-
-#define jparser_ptr(parser, index) ((parser)->data + (index))
-#define jparser_currptr(parser) jparser_ptr((parser), (parser)->curr)
-#define jparser_match(parser, type_) (jparser_currptr(parser)->type == (type_))
-#define jparser_advance(parser) ((parser)->curr++)
-#define jparser_is_end(parser) jparser_match((parser), JTK_EOF)
-#define jparse_end_return ((void*)-1)
-
-typedef struct jparser {
-  int len;
-  int curr;
-  const jtoken_t* data;
-} jparser_t;
-
-static jnode_t* jparse(jparser_t* parser);
+static void jsplit_parse_range(void* ctx, int index) {
+  jsplit_t* split = ctx;
+  jsplit_range_t* range = split->ranges + index;
+  jparser_t parser;
+  jparser_init(&parser, split->buf, range->begin, range->end, &split->parse);
+  jvector_init(jnode_t*, &range->items);
+
+  int ok = jparser_advance(&parser);
+  while (ok) {
+    jnode_t* item = jparse(&parser);
+    if (!item || !jvector_concat(jnode_t*, &range->items, &item, 1)) {
+      jdelete(item);
+      ok = 0;
+    } else if (jparser_is_end(&parser)) {
+      break;
+    } else if (!jparser_match(&parser, ',')) {
+      ok = 0;
+    } else {
+      ok = jparser_advance(&parser);
+    }
+  }
+  jparser_free(&parser);
+  range->failed = !ok;
+}
 
-static jnode_t* jparse_array(jparser_t* parser) {
+jnode_t* jfrom_string_parallel(const char* buf, size_t len,
+                               const jparallel_opts_t* opts, jerr_t* err) {
   jerror_clear();
-  jnode_t* array = jarray_new();
-  if (jparser_match(parser, ']')) {
-    jparser_advance(parser);
-    return array;
+  const jparse_opts_t* parse = opts ? &opts->parse : 0;
+  int threads = opts && opts->threads > 0 ? opts->threads : jcpu_count();
+  size_t min_chunk = opts && opts->min_chunk ? opts->min_chunk
+                                             : SJSON_PARALLEL_CHUNK;
+  if (threads < 2 || len / 2 < min_chunk || (parse && parse->npaths > 0))
+    return jfrom_string_ex(buf, len, parse, err);
+
+  // several runs per thread so that uneven elements still balance
+  size_t target = len / (4 * threads);
+  if (target < min_chunk) target = min_chunk;
+  jvector(size_t, cuts);
+  jvector_init(size_t, &cuts);
+  jsplit_t split = {.buf = buf};
+  if (parse) split.parse = *parse;
+  if (split.parse.max_depth <= 0) split.parse.max_depth = SJSON_MAX_DEPTH;
+  split.parse.max_depth--;
+
+  int nranges = 0;
+  if (jsplit_array(buf, len, target, jas_tv(&cuts)) && split.parse.max_depth)
+    nranges = jvector_len(cuts) - 1;
+  if (nranges > 1)
+    split.ranges = reallocate(0, 0, nranges * sizeof(jsplit_range_t));
+  if (!split.ranges) {
+    // not an array, a single run, or malformed: the sequential parser
+    // reports errors exactly as it always does
+    jvector_free(size_t, &cuts);
+    return jfrom_string_ex(buf, len, parse, err);
   }
-
-  // parse first item
-  jnode_t* first_item = jparse(parser);
-  if (!first_item || first_item == jparse_end_return) {
-    jdelete(array);
-    return 0;
+  for (int i = 0; i < nranges; i++) {
+    split.ranges[i].begin = *jvector_get(cuts, i);
+    split.ranges[i].end = *jvector_get(cuts, i + 1) - 1;  // at ',' or ']'
   }
-  if (!jarray_add(array, first_item)) return 0;
+  jvector_free(size_t, &cuts);
 
-  // parse rest items
-  while (!jparser_is_end(parser) && !jparser_match(parser, ']')) {
-    if (!jparser_match(parser, ',')) {
-      const jtoken_t* tk = jparser_currptr(parser);
-      jerror_log("Expect ',' but got '%.*s'" jtoken_linecol_str,
-                 jtoken_lenlexeme(tk), jtoken_linecol(tk));
-      jdelete(array);
-      return 0;
-    }
-    jparser_advance(parser);
+  jparallel_for(nranges, threads, jsplit_parse_range, &split);
 
-    jnode_t* item = jparse(parser);
-    if (!item || item == jparse_end_return) {
-      jdelete(array);
-      return 0;
+  int total = 0, failed = 0;
+  for (int i = 0; i < nranges; i++) {
+    total += jvector_len(split.ranges[i].items);
+    failed |= split.ranges[i].failed;
+  }
+  jnode_t* json = failed ? 0 : jarray_new();
+  jnode_t** items = json ? reallocate(0, 0, total * sizeof(jnode_t*)) : 0;
+  if (items) {
+    jarray_t* array = jas_array(json);
+    for (int i = 0; i < nranges; i++) {
+      jsplit_range_t* range = split.ranges + i;
+      memcpy(items + array->array.len, range->items.data,
+             range->items.len * sizeof(jnode_t*));
+      array->array.len += range->items.len;
+      jvector_free(jnode_t*, &range->items);
     }
-    if (!jarray_add(array, item)) return 0;
+    for (int i = 0; i < total; i++) {
+      if (jis_linked(items[i])) jas_linked(items[i])->parent = json;
+    }
+    array->array.data = items;
+    array->array.capacity = total;
+  } else {
+    jerror_keep({
+      for (int i = 0; i < nranges; i++) {
+        jsplit_range_t* range = split.ranges + i;
+        jvector_foreach(j, range->items) {
+          jdelete(*jvector_get(range->items, j));
+        }
+        jvector_free(jnode_t*, &range->items);
+      }
+      jdelete(json);
+    });
+    json = 0;
   }
+  reallocate(split.ranges, 0, 0);
 
-  if (jparser_is_end(parser) || !jparser_match(parser, ']')) {
-    const jtoken_t* tk = jparser_currptr(parser);
-    jerror_log("Expect ']' but got '%.*s'" jtoken_linecol_str,
-               jtoken_lenlexeme(tk), jtoken_linecol(tk));
-    jdelete(array);
-    return 0;
+  // errors are rare: parse again sequentially for the usual message
+  if (failed) return jfrom_string_ex(buf, len, parse, err);
+  if (err) {
+    if (json) err->code = JERR_NONE;
+    else *err = jerr_last;
   }
-  jparser_advance(parser);  // discard ']'
-
-  return array;
+  return json;
 }
 
-/* Key copy lexemes. Value is allocated. When key is 0, error happens. */
-static jkv_t jparse_keyvalue(jparser_t* parser) {
-  jerror_clear();
-  jkv_t kv = {};
+/* ==============================
+ *   14. PARALLEL SERIALIZATION
+ * ============================== */
 
-  if (!jparser_match(parser, JTK_STRING)) {
-    const jtoken_t* tk = jparser_currptr(parser);
-    jerror_log("Expect a string but got '%.*s'" jtoken_linecol_str,
-               jtoken_lenlexeme(tk), jtoken_linecol(tk));
-    return kv;
-  }
-  const jtoken_t* key = jparser_currptr(parser);
-  jparser_advance(parser);
+/* Output is guessed at 8 bytes per node when deciding whether threads pay
+ * off. Most documents produce more, so the guess errs on the small side. */
+#define JSHARD_NODE_BYTES 8
+
+/* Members [begin, end) of the split container. */
+typedef struct jshard {
+  int begin;
+  int end;
+  size_t size;
+  char* out;  // 0 while measuring
+  jvector(char, numbers);
+  int failed;
+} jshard_t;
+
+typedef struct jshards {
+  jemitter_t em;  // layout shared by every shard
+  jnode_t* node;  // the split container
+  int depth;
+  jvector(jwalk_key_t, keys);  // object members in output order
+  jshard_t* shards;
+  int nshards;
+} jshards_t;
+
+static int jshard_size(jnode_t* jnode) {
+  if (jis_array(jnode)) return jvector_len(jas_array(jnode)->array);
+  if (jis_object(jnode)) return jht_size(jas_object(jnode)->hashmap);
+  return 0;
+}
 
-  if (!jparser_match(parser, ':')) {
-    const jtoken_t* tk = jparser_currptr(parser);
-    jerror_log("Expect ':' but got '%.*s'" jtoken_linecol_str,
-               jtoken_lenlexeme(tk), jtoken_linecol(tk));
-    return kv;
+/* The container whose members are shared out: the root or, while that has
+ * fewer members than `tasks`, its member with the most members. Cached
+ * containers are copied whole unless pretty, so the search stops there. */
+static jnode_t* jshard_target(jnode_t* jnode, int flags, int tasks,
+                              int* depth) {
+  jnode_t* target = 0;
+  int most = 1;
+  for (int d = 0; jnode && jshard_size(jnode); d++) {
+    if (jcache_of(jnode) && !(flags & JWRITE_PRETTY)) break;
+    int n = jshard_size(jnode);
+    if (n > most) {
+      target = jnode;
+      most = n;
+      *depth = d;
+    }
+    if (n >= tasks) break;
+
+    jnode_t* next = 0;
+    int size = 0;
+    if (jis_array(jnode)) {
+      jarray_t* jarr = jas_array(jnode);
+      jvector_foreach(i, jarr->array) {
+        jnode_t* child = *jvector_get(jarr->array, i);
+        if (jshard_size(child) > size) size = jshard_size(next = child);
+      }
+    } else {
+      jobject_t* jobj = jas_object(jnode);
+      for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
+        for (jkv_t* kv = jht_get(jobj->hashmap, i)->next; kv; kv = kv->next)
+          if (jshard_size(kv->value) > size)
+            size = jshard_size(next = kv->value);
+      }
+    }
+    jnode = next;
   }
-  jparser_advance(parser);
-
-  jnode_t* value = jparse(parser);
-  if (!value || value == jparse_end_return) return kv;
+  return target;
+}
 
-  kv.key = reallocate(kv.key, 0, key->len - 1);
-  if (!kv.key) return kv;
-  strncpy(kv.key, key->as.string, key->len - 2);
-  kv.value = value;
-  return kv;
+static int jshard_count(const jvisit_t* visit, void* ctx) {
+  (void)visit;
+  size_t* budget = ctx;
+  return --*budget ? JWALK_CONTINUE : JWALK_ABORT;
 }
 
-static jnode_t* jparse_object(jparser_t* parser) {
-  jerror_clear();
-  jnode_t* obj = jobject_new();
-  if (jparser_match(parser, '}')) {
-    jparser_advance(parser);
-    return obj;
+/* Measure shard `index` or, once it has a buffer, write it. */
+static void jshard_emit(void* ctx, int index) {
+  jshards_t* sh = ctx;
+  jshard_t* shard = sh->shards + index;
+  jsink_t sink;
+  jsink_init_bounded(&sink, shard->out, shard->out ? shard->size : 0);
+  jemitter_t em = sh->em;
+  em.sink = &sink;
+  em.base = sh->depth + 1;
+  em.numbers = jas_tv(&shard->numbers);
+  em.replay = !!shard->out;
+
+  int ok = 1;
+  for (int i = shard->begin; ok && i < shard->end; i++) {
+    if (jis_array(sh->node)) {
+      jnode_t* child = *jvector_get(jas_array(sh->node)->array, i);
+      ok = jemit_member(&em, i, em.base) && jemit_tree(&em, child);
+    } else {
+      jkv_t* kv = jvector_get(sh->keys, i)->kv;
+      ok = jemit_member(&em, i, em.base) &&
+           jemit_key(&em, kv->key, strlen(kv->key)) &&
+           jemit_tree(&em, kv->value);
+    }
   }
+  shard->size = sink.len + sink.to.dropped;
+  shard->failed = !ok;
+}
 
-  // parse first key value
-  jkv_t first_kv = jparse_keyvalue(parser);
-  if (!first_kv.key) {
-    jdelete(obj);
-    return 0;
+/* Split `jnode` into shards and measure them on `threads` threads. Return 0
+ * when the tree is too small, has no container worth splitting or a shard
+ * failed. */
+static int jshards_measure(jshards_t* sh, jnode_t* jnode,
+                           const jwrite_opts_t* opts,
+                           const jparallel_opts_t* par, int threads) {
+  size_t min_chunk = par && par->min_chunk ? par->min_chunk
+                                           : SJSON_PARALLEL_CHUNK;
+  *sh = (jshards_t){0};
+  jemitter_init(&sh->em, 0, opts);
+  jvector_init(jwalk_key_t, &sh->keys);
+  if (threads < 2) return 0;
+
+  // several shards per thread so that uneven members still balance
+  int tasks = 4 * threads;
+  sh->node = jshard_target(jnode, sh->em.flags, tasks, &sh->depth);
+  if (!sh->node) return 0;
+  size_t nodes = tasks * (min_chunk / JSHARD_NODE_BYTES + 1);
+  size_t budget = nodes;
+  jwalk_ex(sh->node, jshard_count, 0, &budget, 0);
+  nodes = (nodes - budget) * JSHARD_NODE_BYTES / min_chunk;
+  int members = jshard_size(sh->node);
+  if ((size_t)tasks > nodes) tasks = nodes;
+  if (tasks > members) tasks = members;
+  if (tasks < 2) return 0;
+
+  if (jis_object(sh->node)) {
+    jobject_t* jobj = jas_object(sh->node);
+    if (sh->em.flags & JWRITE_SORT_KEYS) {
+      if (!jwalk_sort(jas_tv(&sh->keys), jobj)) return 0;
+    } else {
+      for (int i = 0; i < jht_capacity(jobj->hashmap); i++) {
+        for (jkv_t* kv = jht_get(jobj->hashmap, i)->next; kv;
+             kv = kv->next) {
+          jwalk_key_t key = {.kv = kv};
+          if (!jvector_concat(jwalk_key_t, &sh->keys, &key, 1)) return 0;
+        }
+      }
+    }
   }
-  jobject_put(obj, first_kv.key, first_kv.value);
-  reallocate(first_kv.key, 0, 0);  // free key after copy
+  sh->shards = reallocate(0, 0, tasks * sizeof(jshard_t));
+  if (!sh->shards) return 0;
+  sh->nshards = tasks;
+  for (int i = 0; i < tasks; i++) {
+    sh->shards[i] = (jshard_t){.begin = (long)members * i / tasks,
+                               .end = (long)members * (i + 1) / tasks};
+    jvector_init(char, &sh->shards[i].numbers);
+  }
+  jparallel_for(tasks, threads, jshard_emit, sh);
+  for (int i = 0; i < tasks; i++) {
+    if (sh->shards[i].failed) return 0;
+  }
+  return 1;
+}
 
-  // parse rest key values
-  while (!jparser_is_end(parser) && !jparser_match(parser, '}')) {
-    if (!jparser_match(parser, ',')) {
-      const jtoken_t* tk = jparser_currptr(parser);
-      jerror_log("Expect ',' but got '%.*s'" jtoken_linecol_str,
-                 jtoken_lenlexeme(tk), jtoken_linecol(tk));
-      jdelete(obj);
-      return 0;
-    }
-    jparser_advance(parser);
+static void jshards_free(jshards_t* sh) {
+  for (int i = 0; i < sh->nshards; i++)
+    jvector_free(char, &sh->shards[i].numbers);
+  reallocate(sh->shards, 0, 0);
+  jvector_free(jwalk_key_t, &sh->keys);
+}
 
-    jkv_t kv = jparse_keyvalue(parser);
-    if (!kv.key) {
-      jdelete(obj);
-      return 0;
-    }
-    jobject_put(obj, kv.key, kv.value);
-    reallocate(kv.key, 0, 0);  // key is copied
+/* Write the measured shards into `body` in parallel. */
+static int jshards_write(jshards_t* sh, char* body, int threads) {
+  for (int i = 0; i < sh->nshards; i++) {
+    sh->shards[i].out = body;
+    body += sh->shards[i].size;
   }
+  jparallel_for(sh->nshards, threads, jshard_emit, sh);
+  for (int i = 0; i < sh->nshards; i++) {
+    if (sh->shards[i].failed) return 0;
+  }
+  return 1;
+}
 
-  if (jparser_is_end(parser) && !jparser_match(parser, '}')) {
-    const jtoken_t* tk = jparser_currptr(parser);
-    jerror_log("Expect '}' but got '%.*s'" jtoken_linecol_str,
-               jtoken_lenlexeme(tk), jtoken_linecol(tk));
-    jdelete(obj);
-    return 0;
+/* Everything outside the split container's members, written into a buffer
+ * of its exact size. `*at` receives where the members go. */
+static char* jshards_outer(jshards_t* sh, jnode_t* jnode, size_t extra,
+                           size_t* size, size_t* at) {
+  jvector(char, numbers);
+  jvector_init(char, &numbers);
+  jsink_t sink;
+  jsink_init_bounded(&sink, 0, 0);
+  jemitter_t em = sh->em;
+  em.sink = &sink;
+  em.numbers = jas_tv(&numbers);
+  em.hole = sh->node;
+
+  char* out = 0;
+  if (jemit_tree(&em, jnode)) {
+    *size = sink.to.dropped;
+    *at = em.at;
+    out = reallocate(0, 0, *size + extra + 1);
+    if (out) {
+      jsink_init_bounded(&sink, out, *size);
+      em.replay = 1;
+      em.cursor = 0;
+      if (!jemit_tree(&em, jnode)) out = reallocate(out, 1, 0);
+    }
   }
-  jparser_advance(parser);
+  jvector_free(char, &numbers);
+  return out;
+}
 
-  return obj;
+static size_t jshards_total(jshards_t* sh) {
+  size_t total = 0;
+  for (int i = 0; i < sh->nshards; i++) total += sh->shards[i].size;
+  return total;
 }
 
-static jnode_t* jparse(jparser_t* parser) {
+char* jto_string_parallel(jnode_t* jnode, const jwrite_opts_t* opts,
+                          const jparallel_opts_t* par) {
   jerror_clear();
-  const jtoken_t* tk = jparser_currptr(parser);
-  jparser_advance(parser);
-  switch (tk->type) {
-    case JTK_NULL: return jnull_new();
-    case JTK_TRUE: return jbool_new(1);
-    case JTK_FALSE: return jbool_new(0);
-    case JTK_NUMBER: return jnumber_new(tk->as.number);
-    case JTK_STRING: {
-      if (tk->len <= 2) return jstring_new(0, "");
-      else return jstring_new(tk->len - 2, tk->as.string);
-    }
-    case JTK_EOF: return jparse_end_return;  // End of parsing
-    case '[': return jparse_array(parser);
-    case '{': return jparse_object(parser);
+  int threads = par && par->threads > 0 ? par->threads : jcpu_count();
+  jshards_t sh;
+  char* str = 0;
+  if (jshards_measure(&sh, jnode, opts, par, threads)) {
+    size_t body = jshards_total(&sh), size, at;
+    str = jshards_outer(&sh, jnode, body, &size, &at);
+    if (str) {
+      // open a gap for the members right where they belong
+      memmove(str + at + body, str + at, size - at);
+      str[size + body] = '\0';
+      if (!jshards_write(&sh, str + at, threads)) str = reallocate(str, 1, 0);
+    }
+  }
+  jshards_free(&sh);
+  // small trees, and failures, which are reported as jto_string_opts does
+  return str ? str : jto_string_opts(jnode, opts);
+}
 
-    case ']':
-    case '}':
-    case ',':
-    case ':':           // Should be handled in specific functions
-    default: return 0;  // Unknown token
+/* Hand all of `iov` to an fd, resuming after short writes. */
+static int jwritev(int fd, struct iovec* iov, int n) {
+  while (n) {
+    ssize_t done = writev(fd, iov, n);
+    if (done < 0 && errno == EINTR) continue;
+    if (done <= 0) {
+      jerror_log(JERR_IO, "Failed to write output.");
+      return 0;
+    }
+    for (; n && (size_t)done >= iov->iov_len; iov++, n--)
+      done -= iov->iov_len;
+    if (n) {
+      iov->iov_base = (char*)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
   }
+  return 1;
 }
 
-jnode_t* jfrom_string(const char* json_str) {
+int jwrite_parallel(jnode_t* jnode, jsink_t* sink, const jwrite_opts_t* opts,
+                    const jparallel_opts_t* par) {
   jerror_clear();
-  jlexer_t lexer = {.len = strlen(json_str),
-                    .curr = 0,
-                    .line = 1,
-                    .col = 1,
-                    .data = json_str};
-
-  // lexing
-  jvector(jtoken_t, tokens);
-  jvector_init(jtoken_t, &tokens);
-  if (!jlex(&lexer, jas_tv(&tokens))) {
-    jvector_free(jtoken_t, &tokens);
-    return 0;
+  int threads = par && par->threads > 0 ? par->threads : jcpu_count();
+  jshards_t sh;
+  char *outer = 0, *body = 0;
+  size_t size, at, len = 0;
+  if (jshards_measure(&sh, jnode, opts, par, threads))
+    outer = jshards_outer(&sh, jnode, 0, &size, &at);
+  if (outer) {
+    len = jshards_total(&sh);
+    body = reallocate(0, 0, len);
+    if (body && !jshards_write(&sh, body, threads))
+      body = reallocate(body, 1, 0);
+  }
+  jshards_free(&sh);
+  if (!body) {
+    // small trees, and failures, which are reported as jwrite_opts does
+    reallocate(outer, 1, 0);
+    return jwrite_opts(jnode, sink, opts);
   }
-  // jvector_foreach(i, tokens) {
-  //   jtoken_t* tk = jvector_get(tokens, i);
-  //   printf("[%04d:%04d](%04d) %.*s\n", tk->line, tk->col, tk->type, tk->len,
-  //          tk->lexeme);
-  // }
 
-  // parsing
-  jparser_t parser = {.len = tokens.len, .curr = 0, .data = tokens.data};
-  jnode_t* json = jparse(&parser);
+  int ok;
+  if (sink->kind == JSINK_FD) {
+    struct iovec iov[] = {
+        {.iov_base = outer, .iov_len = at},
+        {.iov_base = body, .iov_len = len},
+        {.iov_base = outer + at, .iov_len = size - at},
+    };
+    ok = jsink_drain(sink) && jwritev(sink->to.fd, iov, 3);
+  } else {
+    ok = jsink_write(sink, outer, at) && jsink_write(sink, body, len) &&
+         jsink_write(sink, outer + at, size - at) && jsink_drain(sink);
+  }
+  reallocate(body, 1, 0);
+  reallocate(outer, 1, 0);
+  return ok;
+}
 
-  jvector_free(jtoken_t, &tokens);
-  return json;
-}
\ No newline at end of file
+#endif
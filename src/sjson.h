@@ -1,8 +1,18 @@
 #ifndef SJSON_H
+#define SJSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /* ======== META DATA ======== */
 
 #define SJSON_VERSION "1.1.0"
+#define SJSON_MAX_DEPTH 512  // default nesting limit of arrays and objects
+#define SJSON_ERRMSG_LEN 256
+#define SJSON_SINK_LEN 4096  // bytes of a sink's own buffer
+#define SJSON_NDJSON_CHUNK (1 << 20)  // default bytes per NDJSON chunk
+#define SJSON_PARALLEL_CHUNK (1 << 18)  // default least bytes per task
 
 /* ======== MACROS ======== */
 
@@ -60,18 +70,30 @@ typedef struct jbool {
   int value;
 } jbool_t;
 
+/* Numbers, strings, arrays and objects start with `type`, `flags` and
+ * `parent`. The null and boolean singletons have no parent since they may
+ * sit in many containers at once. */
 typedef struct jnumber {
   jtype_t type;
+  int flags;
+  jnode_t* parent;
   double value;
 } jnumber_t;
 
 typedef struct jstring {
   jtype_t type;
+  int flags;
+  jnode_t* parent;
   jvector(char, string);
 } jstring_t;
 
+struct jcache;  // serialized bytes of a container, see jnode_cache()
+
 typedef struct jarray {
   jtype_t type;
+  int flags;
+  jnode_t* parent;
+  struct jcache* cache;
   jvector(jnode_t*, array);
 } jarray_t;
 
@@ -84,13 +106,339 @@ typedef struct jkv {
 
 typedef struct jobject {
   jtype_t type;
+  int flags;
+  jnode_t* parent;
+  struct jcache* cache;
   jvector(jkv_t, hashmap);
 } jobject_t;
 
+/* Cursor over the members of an array or object, kept by the caller. Set
+ * up with jiter_init() and advanced with jiter_next(). The container must
+ * not change while it is iterated. */
+typedef struct jiter {
+  jnode_t* node;    // 0 when there is nothing to iterate
+  int index;        // position of the current member, -1 before the first
+  int bucket;       // object only
+  jkv_t* kv;        // object only, current entry
+  const char* key;  // object only, key of the current member
+  jnode_t* value;   // current member
+} jiter_t;
+
+#define jiter_index(it) ((it)->index)
+#define jiter_key(it) ((it)->key)
+#define jiter_value(it) ((it)->value)
+
+/* Small enough to inline into the caller's loop: an array is stepped
+ * through in place, an object bucket by bucket. */
+static inline int jiter_next(jiter_t* it) {
+  if (!it->node) return 0;
+  if (jis_array(it->node)) {
+    jarray_t* jarr = jas_array(it->node);
+    if (it->index + 1 >= jvector_len(jarr->array)) return 0;
+    it->value = *jvector_get(jarr->array, ++it->index);
+    return 1;
+  }
+  jobject_t* jobj = jas_object(it->node);
+  jkv_t* kv = it->kv ? it->kv->next : 0;
+  while (!kv && ++it->bucket < jvector_capacity(jobj->hashmap))
+    kv = jvector_get(jobj->hashmap, it->bucket)->next;
+  if (!kv) return 0;
+  it->index++;
+  it->kv = kv;
+  it->key = kv->key;
+  it->value = kv->value;
+  return 1;
+}
+
+/* Object key with its hash computed once by jkey_init(), for lookups that
+ * repeat the same keys. The string is not copied. */
+typedef struct jkey {
+  const char* key;
+  unsigned int hash;
+} jkey_t;
+
+/* Compiled JSON Pointer or JSONPath query, see jpath_compile(). */
+typedef struct jpath jpath_t;
+
+/* Compiled JSON Patch, see jpatch_compile(). */
+typedef struct jpatch jpatch_t;
+
+/* Struct binding. A schema describes a C struct as a table of fields, each
+ * naming a JSON key, the member it binds to and how. Declare the table with
+ * the jfield_* macros and the schema with jschema_of():
+ *
+ *   static const jfield_t user_fields[] = {
+ *       jfield_int64("id", user_t, id),
+ *       jfield_string("name", user_t, name),
+ *       jfield_array("tags", user_t, tags, ntags, JBIND_STRING, char*, 0),
+ *       jfield_object("home", user_t, home, &address_schema),
+ *   };
+ *   static jschema_t user_schema = jschema_of(user_t, user_fields);
+ */
+enum jbind_type {
+  JBIND_BOOL = 1,  // int
+  JBIND_INT,       // int
+  JBIND_INT64,     // int64_t
+  JBIND_DOUBLE,    // double
+  JBIND_STRING,    // char*, allocated while decoding, 0 for null
+  JBIND_OBJECT,    // struct described by `schema`
+  JBIND_ARRAY,     // pointer to allocated items plus an int count
+};
+
+struct jschema;
+struct jschema_key;  // sorted key table, see jschema_prepare()
+
+typedef struct jfield {
+  const char* key;
+  int type;                 // JBIND_*
+  size_t offset;            // of the member in the struct
+  struct jschema* schema;   // objects and arrays of objects
+  int item;                 // array only, JBIND_* type of the items
+  size_t item_size;         // array only
+  size_t count;             // array only, offset of the int count member
+} jfield_t;
+
+typedef struct jschema {
+  size_t size;  // of the struct
+  const jfield_t* fields;
+  int nfields;
+  struct jschema_key* keys;  // 0 until jschema_prepare()
+} jschema_t;
+
+#define jfield_of(key_, type_, struct_, member) \
+  {.key = (key_), .type = (type_), .offset = offsetof(struct_, member)}
+#define jfield_bool(key, struct_, member) \
+  jfield_of((key), JBIND_BOOL, struct_, member)
+#define jfield_int(key, struct_, member) \
+  jfield_of((key), JBIND_INT, struct_, member)
+#define jfield_int64(key, struct_, member) \
+  jfield_of((key), JBIND_INT64, struct_, member)
+#define jfield_double(key, struct_, member) \
+  jfield_of((key), JBIND_DOUBLE, struct_, member)
+#define jfield_string(key, struct_, member) \
+  jfield_of((key), JBIND_STRING, struct_, member)
+#define jfield_object(key_, struct_, member, schema_) \
+  {.key = (key_),                                     \
+   .type = JBIND_OBJECT,                              \
+   .offset = offsetof(struct_, member),               \
+   .schema = (schema_)}
+#define jfield_array(key_, struct_, member, count_, item_, item_type, \
+                     schema_)                                         \
+  {.key = (key_),                                                     \
+   .type = JBIND_ARRAY,                                               \
+   .offset = offsetof(struct_, member),                               \
+   .schema = (schema_),                                               \
+   .item = (item_),                                                   \
+   .item_size = sizeof(item_type),                                    \
+   .count = offsetof(struct_, count_)}
+#define jschema_of(struct_, fields_)                      \
+  {.size = sizeof(struct_),                               \
+   .fields = (fields_),                                   \
+   .nfields = (int)(sizeof(fields_) / sizeof(*(fields_)))}
+
+/* Columnar extraction. A column names a key of the objects in an array and
+ * receives one cell per element in contiguous storage of the caller. A
+ * missing key or null leaves the cell zero and its validity bit clear. */
+enum jcolumn_type {
+  JCOLUMN_DOUBLE = 1,  // double
+  JCOLUMN_INT64,       // int64_t, integral numbers only
+  JCOLUMN_STRING,      // jstrview_t
+};
+
+/* Bytes of a string held elsewhere, not null-terminated. */
+typedef struct jstrview {
+  const char* data;
+  int len;
+} jstrview_t;
+
+typedef struct jcolumn {
+  const char* key;  // not copied
+  int type;         // JCOLUMN_*
+  void* cells;      // one per row
+  uint64_t* valid;  // bit i set when row i has a value, may be 0
+} jcolumn_t;
+
+/* Reader of columns from raw input, see jcolumns_open(). */
+typedef struct jcolumns jcolumns_t;
+
+/* Visit of one node during jwalk(). */
+typedef struct jvisit {
+  jnode_t* node;
+  jnode_t* parent;  // 0 for the root
+  const char* key;  // member key when parent is an object, otherwise 0
+  int index;        // position of the node in its parent
+  int depth;        // 0 for the root
+} jvisit_t;
+
+/* Returned by visitors. A skipped container is neither entered nor passed to
+ * the post-order visitor. */
+enum jwalk_action {
+  JWALK_ABORT = 0,
+  JWALK_CONTINUE,
+  JWALK_SKIP,
+};
+
+typedef int (*jvisitor_t)(const jvisit_t* visit, void* ctx);
+
+enum jparse_flag {
+  JPARSE_UTF8 = 1 << 0,  // reject strings which are not valid UTF-8
+};
+
+/* Projection: with `paths` set, only the subtrees they select are made
+ * into nodes. Containers on the way down keep just the members leading to
+ * a selected subtree, and skipped array elements before a kept one become
+ * null, so the same queries find the same nodes in the result. Skipped
+ * input is only checked for valid strings and balanced brackets. Paths may
+ * not use `..` or negative indexes. */
+typedef struct jparse_opts {
+  int max_depth;  // nesting limit of arrays and objects, 0 for SJSON_MAX_DEPTH
+  int flags;      // JPARSE_* flags
+  const jpath_t* const* paths;  // compiled queries, 0 to keep everything
+  int npaths;
+} jparse_opts_t;
+
+typedef enum jerrcode {
+  JERR_NONE = 0,
+  JERR_MEMORY,
+  JERR_SYNTAX,
+  JERR_DEPTH,
+  JERR_UTF8,
+  JERR_TYPE,   // node has an unexpected type
+  JERR_INDEX,  // index out of range
+  JERR_KEY,    // key not found
+  JERR_ARG,    // invalid argument
+  JERR_IO,     // a sink failed to write or a file to be read
+  JERR_TEST,   // a JSON Patch test operation failed
+} jerrcode_t;
+
+/* Position fields are only set for errors in JSON input. */
+typedef struct jerr {
+  jerrcode_t code;
+  size_t offset;  // byte offset of the error in the input
+  int line;       // 1-based
+  int col;        // 1-based
+  char msg[SJSON_ERRMSG_LEN];
+} jerr_t;
+
+/* Output layout. Without flags members are separated by ", " and keys by
+ * ": ", on one line. */
+enum jwrite_flag {
+  JWRITE_COMPACT = 1 << 0,    // no insignificant whitespace
+  JWRITE_PRETTY = 1 << 1,     // one member per line, wins over compact
+  JWRITE_SORT_KEYS = 1 << 2,  // object members in byte-wise key order
+  JWRITE_CANONICAL = JWRITE_COMPACT | JWRITE_SORT_KEYS,
+};
+
+typedef struct jwrite_opts {
+  int flags;   // JWRITE_* flags
+  int indent;  // spaces per level when pretty, 0 for 2
+} jwrite_opts_t;
+
+/* Receives serialized bytes from a sink. Return 0 to fail the write. */
+typedef int (*jsink_callback_t)(const char* data, size_t len, void* ctx);
+
+enum jsink_kind {
+  JSINK_BOUNDED = 0,  // internal, keeps what fits and counts the rest
+  JSINK_FD,
+  JSINK_FILE,
+  JSINK_CALLBACK,
+};
+
+/* Output of jwrite(). Bytes collect in `buf` and are flushed whenever it
+ * fills, so the whole output is never held at once. Set up with one of the
+ * jsink_init_* functions. */
+typedef struct jsink {
+  int kind;
+  char* buf;
+  size_t len;  // bytes waiting in `buf`
+  size_t cap;
+  union {
+    int fd;
+    FILE* file;
+    struct {
+      jsink_callback_t callback;
+      void* ctx;
+    } user;
+    size_t dropped;  // bounded only
+  } to;
+  char local[SJSON_SINK_LEN];  // used when no buffer is given
+} jsink_t;
+
+/* Builds JSON straight into a sink, without nodes. Calls are checked
+ * against the grammar: a misplaced call fails and so does every later one.
+ * Fields are private. */
+typedef struct jwriter {
+  jsink_t* sink;
+  int flags;
+  int indent;
+  int depth;
+  int state;
+  unsigned char objects[SJSON_MAX_DEPTH / 8];  // one bit per open container
+} jwriter_t;
+
+/* Receives ownership of one parsed document. Return 0 to stop reading. */
+typedef int (*jndjson_callback_t)(jnode_t* doc, void* ctx);
+
+typedef struct jndjson_opts {
+  int threads;        // parsing threads, 0 for the number of online CPUs
+  int ordered;        // deliver documents in input order
+  int max_pending;    // chunks parsed ahead of delivery, 0 for 2 per thread
+  size_t chunk_size;  // bytes per chunk, 0 for SJSON_NDJSON_CHUNK
+  jparse_opts_t parse;
+} jndjson_opts_t;
+
+typedef struct jparallel_opts {
+  int threads;       // worker threads, 0 for the number of online CPUs
+  size_t min_chunk;  // least bytes per task, 0 for SJSON_PARALLEL_CHUNK
+  jparse_opts_t parse;
+} jparallel_opts_t;
+
 /* ======== FUNCTIONS ======== */
 
+/* Functions which only read a tree (getters, jwalk without mutating
+ * visitors, jto_string, jclone of a source) have no side effects on it, so
+ * a tree can be shared by any number of reader threads as long as nobody
+ * writes to it at the same time. Serializing or hashing a tree with caches
+ * enabled (jnode_cache) refreshes them and counts as a write. */
+
 char* jto_string(jnode_t* jnode);  // returned string should be freed manually
+int jwrite(jnode_t* jnode, jsink_t* sink);  // serialize and flush
+size_t jto_buffer(jnode_t* jnode, char* buf,
+                  size_t cap);  // like snprintf, 0 on error
+char* jto_string_opts(jnode_t* jnode, const jwrite_opts_t* opts);
+int jwrite_opts(jnode_t* jnode, jsink_t* sink, const jwrite_opts_t* opts);
+size_t jto_buffer_opts(jnode_t* jnode, char* buf, size_t cap,
+                       const jwrite_opts_t* opts);
 jnode_t* jfrom_string(const char* json_str);
+jnode_t* jfrom_string_opts(const char* json_str, const jparse_opts_t* opts);
+jnode_t* jfrom_string_ex(const char* buf, size_t len,
+                         const jparse_opts_t* opts,
+                         jerr_t* err);  // `buf` needs no null terminator
+
+/* A null `buf` or a zero `cap` selects the sink's own buffer. */
+void jsink_init_fd(jsink_t* sink, int fd, char* buf, size_t cap);
+void jsink_init_file(jsink_t* sink, FILE* file, char* buf, size_t cap);
+void jsink_init_callback(jsink_t* sink, jsink_callback_t callback, void* ctx,
+                         char* buf, size_t cap);
+int jsink_put(jsink_t* sink, const char* data, size_t len);
+int jsink_flush(jsink_t* sink);
+
+void jwriter_init(jwriter_t* writer, jsink_t* sink);
+void jwriter_init_opts(jwriter_t* writer, jsink_t* sink,
+                       const jwrite_opts_t* opts);  // keys keep call order
+int jwriter_begin_object(jwriter_t* writer);
+int jwriter_end_object(jwriter_t* writer);
+int jwriter_begin_array(jwriter_t* writer);
+int jwriter_end_array(jwriter_t* writer);
+int jwriter_key(jwriter_t* writer, const char* key,
+                int len);  // when len is 0, automatically call strlen
+int jwriter_value_null(jwriter_t* writer);
+int jwriter_value_bool(jwriter_t* writer, int value);
+int jwriter_value_number(jwriter_t* writer, double value);
+int jwriter_value_string(jwriter_t* writer, const char* string,
+                         int len);  // when len is 0, automatically call strlen
+int jwriter_value_node(jwriter_t* writer, jnode_t* jnode);  // copy a tree
+int jwriter_finish(jwriter_t* writer);  // check completeness and flush
 
 jnode_t* jnull_new();           // return a singleton pointer
 jnode_t* jbool_new(int value);  // return a singleton pointer
@@ -100,6 +448,28 @@ jnode_t* jstring_new(
 jnode_t* jarray_new();
 jnode_t* jobject_new();
 void jdelete(jnode_t* jnode);
+jnode_t* jclone(jnode_t* jnode);  // deep copy
+int jnumber_set(jnode_t* jnode, double value);
+
+/* Keep the serialized bytes of an array or object between calls, so that
+ * an unchanged subtree is copied instead of serialized again, and likewise
+ * its jhash(). Changes made through this API invalidate the caches on their
+ * way up to the root. Pretty output never uses caches. */
+int jnode_cache(jnode_t* jnode, int enable);
+
+/* Structural hash and equality. Objects are equal whatever the order of
+ * their members, arrays only in the same order, and numbers compare by
+ * value, so equal trees hash the same. jequal() stops at the first
+ * difference. Hashes depend on the platform and are not meant to be
+ * stored. Hashing a tree with caches enabled keeps the hash of every
+ * cached container and counts as a write. */
+uint64_t jhash(jnode_t* jnode);      // 0 on error
+int jequal(jnode_t* a, jnode_t* b);  // 0 when different or on error
+
+/* Depth-first traversal with an explicit stack. `pre` runs before children,
+ * `post` after them; leaves get both back to back. Either may be 0. Return 0
+ * when a visitor aborts or memory runs out. */
+int jwalk(jnode_t* jnode, jvisitor_t pre, jvisitor_t post, void* ctx);
 
 int jstring_len(jnode_t* jnode);
 char jstring_get(jnode_t* jnode, int index);
@@ -110,6 +480,11 @@ int jstring_concat(jnode_t* jnode, const char* string);
 int jstring_pop(jnode_t* jnode);
 int jstring_remove(jnode_t* jnode, int index);
 int jstring_truncate(jnode_t* jnode, int len);  // retain string of length `len`
+int jstring_splice(jnode_t* jnode, int index, int remove, const char* string,
+                   int insert);  // replace `remove` bytes by `insert` bytes
+int jstring_append_n(jnode_t* jnode, const char* string, int len);
+int jstring_reserve(jnode_t* jnode, int capacity);  // room for `capacity` bytes
+int jstring_shrink_to_fit(jnode_t* jnode);
 
 int jarray_size(jnode_t* jnode);
 jnode_t* jarray_get(jnode_t* jnode, int index);
@@ -118,7 +493,16 @@ int jarray_insert(jnode_t* jnode, int index,
                   jnode_t* value);  // move into array
 int jarray_pop(jnode_t* jnode);
 int jarray_remove(jnode_t* jnode, int index);
+int jarray_splice(jnode_t* jnode, int index, int remove, jnode_t** items,
+                  int insert);  // delete `remove` items, move `items` in
+int jarray_extend(jnode_t* jnode, jnode_t** items,
+                  int len);  // move into array
+int jarray_reserve(jnode_t* jnode,
+                   int capacity);  // room for `capacity` items
+int jarray_shrink_to_fit(jnode_t* jnode);
 void jarray_foreach(jnode_t* jnode, void (*f)(jnode_t*));
+void jarray_foreach_ctx(jnode_t* jnode, void (*f)(jnode_t*, void*),
+                        void* ctx);  // `ctx` is passed through to `f`
 
 int jobject_size(jnode_t* jnode);
 int jobject_has(jnode_t* jnode, const char* key);
@@ -126,8 +510,132 @@ jnode_t* jobject_get(jnode_t* jnode, const char* key);
 int jobject_put(jnode_t* jnode, const char* key,
                 jnode_t* value);  // move when non-exists. overwrite when
                                   // exists. erase when value is null.
+int jobject_compact(jnode_t* jnode);  // rehash to fit the current size
+/* Look up `n` keys at once. `out[i]` gets the value of `keys[i]`, or 0 with
+ * bit i of `missing` (may be 0, (n + 63) / 64 words) set when it is absent.
+ * Missing keys are not errors. Return the number of keys found. */
+int jobject_get_many(jnode_t* jnode, const char* const* keys, int n,
+                     jnode_t** out, uint64_t* missing);
+int jobject_get_keys(jnode_t* jnode, const jkey_t* keys, int n, jnode_t** out,
+                     uint64_t* missing);  // same with pre-hashed keys
+void jkey_init(jkey_t* key, const char* string);
 void jobject_foreach(jnode_t* jnode, void (*f)(const char*, jnode_t*));
+void jobject_foreach_ctx(jnode_t* jnode,
+                         void (*f)(const char*, jnode_t*, void*),
+                         void* ctx);  // `ctx` is passed through to `f`
+
+int jiter_init(jiter_t* it, jnode_t* jnode);  // array or object
+
+/* Queries are compiled once, with keys unescaped and hashed, and can then
+ * run against any number of documents from any number of threads. A JSON
+ * Pointer (RFC 6901) names at most one node. A path starts with `$` and
+ * goes on with `.name`, `['name']`, `[index]` (negative counts from the
+ * end), `.*` or `[*]` for every member, and `..` for all descendants, as
+ * in `$.store..price` or `$.items[*].id`. */
+jpath_t* jpointer_compile(const char* pointer);  // "" names the root
+jpath_t* jpath_compile(const char* query);
+void jpath_free(jpath_t* path);
+jnode_t* jpath_get(const jpath_t* path, jnode_t* jnode);  // first match
+int jpath_foreach(const jpath_t* path, jnode_t* jnode,
+                  int (*f)(jnode_t*, void*),
+                  void* ctx);  // `f` returns 0 to stop
+int jpath_select(const jpath_t* path, jnode_t* jnode, jnode_t** out,
+                 int cap);  // like snprintf: all matches counted, -1 on error
+jnode_t* jpointer_get(jnode_t* jnode,
+                      const char* pointer);  // compile, run and free
+
+/* Check a schema, and the schemas it refers to, and sort their keys for
+ * lookups. Call once before the schema is used, and before it is shared
+ * between threads. */
+int jschema_prepare(jschema_t* schema);
+void jschema_release(jschema_t* schema);  // free what jschema_prepare made
+
+/* Decode one JSON object into `dst` without making any node. The struct is
+ * zeroed first. Unknown keys are skipped and missing ones stay zero, as do
+ * members given null. On failure nothing stays allocated. Nesting is capped
+ * at SJSON_MAX_DEPTH, and a larger `max_depth` is a JERR_ARG error. */
+int jbind_decode(const jschema_t* schema, void* dst, const char* buf,
+                 size_t len, const jparse_opts_t* opts, jerr_t* err);
+void jbind_free(const jschema_t* schema,
+                void* dst);  // free strings and arrays, not `dst` itself
+int jbind_write(jwriter_t* writer, const jschema_t* schema,
+                const void* src);  // one object, keys in field order
+char* jbind_to_string(const jschema_t* schema, const void* src,
+                      const jwrite_opts_t* opts);  // should be freed manually
+
+/* Fill `ncols` columns from the elements [first, first + cap) of an array
+ * of objects (or nulls). Keys are hashed once per call and looked up in
+ * batches. String cells point into the nodes, and integers beyond 2^53 are
+ * only as exact as the numbers in the tree. Return the number of rows
+ * filled, -1 on error. */
+int jcolumns_extract(jnode_t* jnode, int first, const jcolumn_t* cols,
+                     int ncols, int cap);
+/* Read the same straight from a JSON array in [buf, buf + len) without
+ * making any node, batch by batch. Each jcolumns_next() fills rows from 0
+ * up to `cap` (> 0) and returns how many, 0 once the array is done and -1
+ * on error. String cells point into `buf`, or into the reader for strings
+ * with escapes, until the next batch. Integers are exact. Values of other
+ * keys are skipped as in projection parsing. */
+jcolumns_t* jcolumns_open(const char* buf, size_t len, const jcolumn_t* cols,
+                          int ncols, const jparse_opts_t* opts);
+int jcolumns_next(jcolumns_t* reader, int cap, jerr_t* err);
+void jcolumns_close(jcolumns_t* reader);
+
+/* Patches change the tree at `*target`, which must not have a parent, and
+ * may replace it. Their cost follows the size of the patch, not of the
+ * target. jmerge_patch() applies an RFC 7386 merge patch and consumes
+ * `patch`: its values are moved into the target, never copied. */
+int jmerge_patch(jnode_t** target, jnode_t* patch);
+/* RFC 6902. The operations are checked, their pointers compiled and their
+ * values copied once, so a patch can be applied to many targets. Applying
+ * stops at the first operation which fails. The ones before it stay done,
+ * the failed one changes nothing. A failed test is a JERR_TEST error. */
+jpatch_t* jpatch_compile(jnode_t* ops);  // an array of operation objects
+void jpatch_free(jpatch_t* patch);
+int jpatch_apply(jnode_t** target, const jpatch_t* patch);
+/* Operations turning `a` into `b`, as an array for jpatch_compile().
+ * Identical nodes and containers whose kept hashes match are skipped
+ * without looking inside; when both roots have caches enabled the hashes
+ * are refreshed first (see jhash()). Array changes at one place give one
+ * operation per element changed. */
+jnode_t* jdiff(jnode_t* a, jnode_t* b);
+
+/* Check that [buf, buf + len) is one JSON text without building any node.
+ * Return 1 when valid. On failure `err` (may be 0) locates the problem. */
+int jvalidate(const char* buf, size_t len, jerr_t* err);
+int jvalidate_opts(const char* buf, size_t len, const jparse_opts_t* opts,
+                   jerr_t* err);
+
+#ifndef SJSON_NO_PARALLEL
+/* Newline-delimited JSON. Input is split into newline-aligned chunks parsed
+ * by a pool of worker threads. The callback runs on the calling thread, one
+ * document at a time. Blank lines are skipped. Return 1 when all input was
+ * consumed, 0 on error or when the callback stops. */
+int jndjson_parse(const char* buf, size_t len, const jndjson_opts_t* opts,
+                  jndjson_callback_t callback, void* ctx);
+int jndjson_read(const char* path, const jndjson_opts_t* opts,
+                 jndjson_callback_t callback, void* ctx);  // mmap the file
+
+/* Same result as jfrom_string_ex(). When the input is one large array, a
+ * quick pass cuts its body into runs of whole elements which are parsed on
+ * worker threads and joined into a single array without copying. Anything
+ * else, and small inputs, are parsed on the calling thread. */
+jnode_t* jfrom_string_parallel(const char* buf, size_t len,
+                               const jparallel_opts_t* opts, jerr_t* err);
+
+/* Same output as jto_string_opts() and jwrite_opts(). The members of the
+ * largest container near the root are cut into runs which worker threads
+ * measure and then write straight into their final place, so the output is
+ * held in memory once. An fd sink receives it with a single writev(). Small
+ * trees are written on the calling thread; `parse` is not used. */
+char* jto_string_parallel(jnode_t* jnode, const jwrite_opts_t* opts,
+                          const jparallel_opts_t* par);
+int jwrite_parallel(jnode_t* jnode, jsink_t* sink, const jwrite_opts_t* opts,
+                    const jparallel_opts_t* par);
+#endif
 
-const char* jerror();  // return 0 when no error.
+/* Error state is kept per thread and reset by every API call. */
+const char* jerror();           // return 0 when no error.
+const jerr_t* jerror_detail();  // return 0 when no error.
 
 #endif
\ No newline at end of file